@@ -65,6 +65,13 @@ struct Flags
   int NINJ; //number of frequency segments;
   int NDATA;  //number of frequency segments;
   int NT;    //number of time segments
+  int threads; //number of threads running segment updates
+  int padding; //frequency bins shared by neighbouring windows (gb_global)
+  int cadence; //iterations between edge-source exchanges (gb_global)
+  int checkpoint; //iterations between checkpoints (0 to disable)
+  int resume; //continue from the last checkpoint?
+  int targetESS; //stop once the cold chain has this many effective samples (0 to disable)
+  int walltime; //seconds the run has to finish in, NMCMC is fit to it (0 to disable)
   int NMAX;  //max number of sources
   int DMAX;  //max dimension of signal model
   int zeroNoise;
@@ -82,6 +89,15 @@ struct Flags
   int burnin;
   int update;
   int rj;
+  int dr; //delayed rejection mode-hopping moves?
+  int mtm; //candidates per multiple-try move (0 to disable)
+  int deo; //deterministic even/odd (non-reversible) swap schedule?
+  int tuneLadder; //space temperatures by swap rejection rates instead of adapting to acceptance?
+  int hotSteps; //fewest source and noise updates per iteration given to hot chains
+  int fstatFFT; //frequency bins each FFT F-statistic kernel is reused over (0 for exact filters)
+  int fstatRefine; //times the loudest F-statistic cells are split (0 for a uniform grid)
+  double fisherRefresh; //Fisher-metric distance a source moves before its Fisher matrix is redone (0 for every 100 iterations)
+  double adaptWeights; //least weight a proposal keeps when burn-in re-weights them by cost (0 for fixed weights)
   int gap; //are we fitting for a time-gap in the data?
   int calibration; //are we marginalizing over calibration  uncertainty?
   int confNoise; //include model of confusion noise in Sn(f)
@@ -89,6 +105,7 @@ struct Flags
   char **injFile;
   char cdfFile[128];
   char pdfFile[128];
+  char cacheDir[128]; //directory of cached F-statistic proposals (empty to disable)
 };
 
 struct Chain
@@ -104,9 +121,17 @@ struct Chain
   double annealing;
   double logLmax;
   
+  //replica round trips and swap statistics
+  int *direction;     //last extreme each replica visited (+1 cold, -1 hottest)
+  int *roundTrips;    //cold->hottest->cold trips completed by each replica
+  int *swapTrial;     //swaps proposed between temperatures ic and ic+1
+  double *swapReject; //summed rejection probability between ic and ic+1
+  int ladderRound;    //swaps per pair before the ladder is next tuned
+  
   //thread-safe RNG
   const gsl_rng_type **T;
   gsl_rng **r;
+  unsigned long seed; //key for counter-based RNG streams
   
   //chain files
   FILE **noiseFile;
@@ -118,6 +143,14 @@ struct Chain
   FILE *temperatureFile;
 };
 
+struct History
+{
+  int size;  //capacity of the ring buffer
+  int N;     //number of stored states
+  int next;  //slot the next state is written to
+  double **params; //past parameters [state][parameter]
+};
+
 struct Source
 {
   //Intrinsic
@@ -154,11 +187,17 @@ struct Source
   double **fisher_matrix;
   double **fisher_evectr;
   double *fisher_evalue;
+  double *fisher_params; //parameters the Fisher matrix was computed at
+  int fisher_trial;      //Fisher jumps of this source since then
+  int fisher_accept;     //and how many of them were accepted
 
   //Package parameters for waveform generator
   int NP;
   double *params;
 
+  //Thinned history of this source, moved with it by RJ deaths (shared by a model and its trial)
+  struct History *history;
+
 };
 
 struct Noise
@@ -0,0 +1,383 @@
+//
+//  GalacticBinaryCheckpoint.c
+//
+//
+//  Binary checkpoints of the full sampler state.
+//
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gsl/gsl_rng.h>
+
+#include "LISA.h"
+#include "GalacticBinary.h"
+#include "GalacticBinaryModel.h"
+#include "GalacticBinaryPrior.h"
+#include "GalacticBinaryProposal.h"
+#include "GalacticBinaryConvergence.h"
+#include "GalacticBinaryCheckpoint.h"
+
+#define CHECKPOINT_VERSION 6
+#define CHECKPOINT_HEADER  17
+
+static void write_block(const void *ptr, size_t size, size_t n, FILE *fptr, char *filename)
+{
+  if(fwrite(ptr, size, n, fptr) != n)
+  {
+    fprintf(stderr,"Failed writing checkpoint %s\n",filename);
+    exit(1);
+  }
+}
+
+static void read_block(void *ptr, size_t size, size_t n, FILE *fptr, char *filename)
+{
+  if(fread(ptr, size, n, fptr) != n)
+  {
+    fprintf(stderr,"Checkpoint %s is truncated\n",filename);
+    exit(1);
+  }
+}
+
+static int chain_file_list(struct Chain *chain, struct Flags *flags, FILE **files)
+{
+  int n=0;
+
+  files[n++] = chain->likelihoodFile;
+  files[n++] = chain->temperatureFile;
+  files[n++] = chain->chainFile[0];
+  files[n++] = chain->parameterFile[0];
+  files[n++] = chain->noiseFile[0];
+  for(int i=0; i<flags->DMAX; i++) files[n++] = chain->dimensionFile[i];
+  if(flags->calibration) files[n++] = chain->calibrationFile[0];
+
+  if(flags->verbose)
+  {
+    for(int ic=1; ic<chain->NC; ic++)
+    {
+      files[n++] = chain->parameterFile[ic];
+      files[n++] = chain->chainFile[ic];
+      files[n++] = chain->noiseFile[ic];
+    }
+  }
+  return n;
+}
+
+static void truncate_chain_files(struct Chain *chain, struct Flags *flags, long *offset)
+{
+  FILE **files = malloc((6+flags->DMAX+3*chain->NC)*sizeof(FILE *));
+  int Nfiles = chain_file_list(chain, flags, files);
+
+  for(int n=0; n<Nfiles; n++)
+  {
+    long length = (offset==NULL) ? 0 : offset[n];
+    fflush(files[n]);
+    if(ftruncate(fileno(files[n]), length))
+    {
+      fprintf(stderr,"Could not rewind chain file to %li bytes\n",length);
+      exit(1);
+    }
+    fseek(files[n], 0, SEEK_END);
+  }
+  free(files);
+}
+
+static void waveform_samples(struct Data *data, FILE *fptr, char *filename, int save)
+{
+  int NT = data->NT;
+
+  for(int n=0; n<2*data->N; n++)
+  {
+    for(int l=0; l<data->Nchannel; l++)
+    {
+      for(int m=0; m<NT; m++)
+      {
+        if(save)
+        {
+          write_block(data->h_rec[n][l][m], sizeof(double), data->Nwave, fptr, filename);
+          write_block(data->h_res[n][l][m], sizeof(double), data->Nwave, fptr, filename);
+        }
+        else
+        {
+          read_block(data->h_rec[n][l][m], sizeof(double), data->Nwave, fptr, filename);
+          read_block(data->h_res[n][l][m], sizeof(double), data->Nwave, fptr, filename);
+        }
+      }
+    }
+  }
+
+  for(int n=0; n<data->N; n++)
+  {
+    for(int l=0; l<data->Nchannel; l++)
+    {
+      for(int m=0; m<NT; m++)
+      {
+        if(save)
+        {
+          write_block(data->r_pow[n][l][m], sizeof(double), data->Nwave, fptr, filename);
+          write_block(data->h_pow[n][l][m], sizeof(double), data->Nwave, fptr, filename);
+          write_block(data->S_pow[n][l][m], sizeof(double), data->Nwave, fptr, filename);
+        }
+        else
+        {
+          read_block(data->r_pow[n][l][m], sizeof(double), data->Nwave, fptr, filename);
+          read_block(data->h_pow[n][l][m], sizeof(double), data->Nwave, fptr, filename);
+          read_block(data->S_pow[n][l][m], sizeof(double), data->Nwave, fptr, filename);
+        }
+      }
+    }
+  }
+}
+
+static void history_state(struct Model *model, FILE *fptr, char *filename, int save)
+{
+  for(int n=0; n<model->Nmax; n++)
+  {
+    struct History *history = model->source[n]->history;
+    if(history==NULL) continue;
+
+    if(save)
+    {
+      write_block(&history->N,    sizeof(int), 1, fptr, filename);
+      write_block(&history->next, sizeof(int), 1, fptr, filename);
+      for(int k=0; k<history->N; k++) write_block(history->params[k], sizeof(double), model->NP, fptr, filename);
+    }
+    else
+    {
+      read_block(&history->N,    sizeof(int), 1, fptr, filename);
+      read_block(&history->next, sizeof(int), 1, fptr, filename);
+      for(int k=0; k<history->N; k++) read_block(history->params[k], sizeof(double), model->NP, fptr, filename);
+    }
+  }
+}
+
+static void checkpoint_header(struct Data **data, struct Model ***model, struct Chain *chain, struct Flags *flags, struct Convergence *conv, long *header)
+{
+  header[0]  = CHECKPOINT_VERSION;
+  header[1]  = chain->NC;
+  header[2]  = chain->NP;
+  header[3]  = (long)chain->seed;
+  header[4]  = flags->NDATA;
+  header[5]  = flags->NT;
+  header[6]  = flags->DMAX;
+  header[7]  = flags->verbose;
+  header[8]  = flags->calibration;
+  header[9]  = data[0]->N;
+  header[10] = data[0]->Nchannel;
+  header[11] = data[0]->Nwave;
+  header[12] = model_state_size(model[0][0]);
+  header[13] = fisher_state_size(model[0][0]);
+  header[14] = conv->K;
+  header[15] = conv->Nmax;
+  header[16] = (model[0][0]->source[0]->history==NULL) ? 0 : model[0][0]->source[0]->history->size;
+}
+
+void save_checkpoint(char *filename, struct Data **data, struct Model ***model, struct Chain *chain, struct Flags *flags, struct Proposal ***proposal, struct Convergence *conv, int mcmc, int cycle)
+{
+  int NC = chain->NC;
+  char tempname[1024];
+
+  //write to a scratch file so a crash mid-write leaves the last checkpoint intact
+  sprintf(tempname,"%s.tmp",filename);
+  FILE *fptr = fopen(tempname,"wb");
+  if(fptr==NULL)
+  {
+    fprintf(stderr,"Could not open checkpoint %s\n",tempname);
+    exit(1);
+  }
+
+  long header[CHECKPOINT_HEADER];
+  checkpoint_header(data, model, chain, flags, conv, header);
+  write_block(header, sizeof(long), CHECKPOINT_HEADER, fptr, filename);
+
+  //iteration counters (and therefore the random streams)
+  write_block(&mcmc,  sizeof(int), 1, fptr, filename);
+  write_block(&cycle, sizeof(int), 1, fptr, filename);
+
+  //run length and thinning (rescaled by --walltime)
+  write_block(&flags->NMCMC, sizeof(int), 1, fptr, filename);
+  for(int i=0; i<flags->NDATA; i++) write_block(&data[i]->downsample, sizeof(int), 1, fptr, filename);
+
+  //parallel tempering
+  write_block(chain->index,       sizeof(int),    NC, fptr, filename);
+  write_block(chain->temperature, sizeof(double), NC, fptr, filename);
+  write_block(chain->acceptance,  sizeof(double), NC, fptr, filename);
+  write_block(chain->avgLogL,     sizeof(double), NC, fptr, filename);
+  for(int ic=0; ic<NC; ic++) write_block(chain->dimension[ic], sizeof(int), flags->DMAX, fptr, filename);
+  write_block(&chain->logLmax,   sizeof(double), 1, fptr, filename);
+  write_block(&chain->annealing, sizeof(double), 1, fptr, filename);
+  write_block(chain->direction,    sizeof(int),    NC, fptr, filename);
+  write_block(chain->roundTrips,   sizeof(int),    NC, fptr, filename);
+  write_block(chain->swapTrial,    sizeof(int),    NC, fptr, filename);
+  write_block(chain->swapReject,   sizeof(double), NC, fptr, filename);
+  write_block(&chain->ladderRound, sizeof(int),    1,  fptr, filename);
+
+  //proposal counters, timers and weights
+  for(int i=0; i<flags->NDATA; i++)
+  {
+    for(int k=0; k<chain->NP+1; k++)
+    {
+      write_block(proposal[i][k]->trial,   sizeof(int),    NC, fptr, filename);
+      write_block(proposal[i][k]->accept,  sizeof(int),    NC, fptr, filename);
+      write_block(proposal[i][k]->time,    sizeof(double), NC, fptr, filename);
+      write_block(&proposal[i][k]->weight, sizeof(double), 1,  fptr, filename);
+    }
+  }
+
+  //models
+  double *state  = malloc(header[12]*sizeof(double));
+  double *fisher = malloc(header[13]*sizeof(double));
+  for(int ic=0; ic<NC; ic++)
+  {
+    for(int i=0; i<flags->NDATA; i++)
+    {
+      pack_model_state(model[ic][i], state);
+      pack_fisher_state(model[ic][i], fisher);
+      write_block(state,  sizeof(double), header[12], fptr, filename);
+      write_block(fisher, sizeof(double), header[13], fptr, filename);
+      history_state(model[ic][i], fptr, filename, 1);
+    }
+  }
+  free(state);
+  free(fisher);
+
+  //waveform samples for the reconstruction
+  for(int i=0; i<flags->NDATA; i++) waveform_samples(data[i], fptr, filename, 1);
+
+  //convergence monitor
+  write_block(&conv->n,      sizeof(int), 1, fptr, filename);
+  write_block(&conv->stride, sizeof(int), 1, fptr, filename);
+  write_block(&conv->count,  sizeof(int), 1, fptr, filename);
+  for(int k=0; k<conv->K; k++) write_block(conv->x[k], sizeof(double), conv->n, fptr, filename);
+
+  //length of each chain file
+  FILE **files = malloc((6+flags->DMAX+3*NC)*sizeof(FILE *));
+  int Nfiles = chain_file_list(chain, flags, files);
+  for(int n=0; n<Nfiles; n++)
+  {
+    fflush(files[n]);
+    fseek(files[n], 0, SEEK_END);
+    long offset = ftell(files[n]);
+    write_block(&offset, sizeof(long), 1, fptr, filename);
+  }
+  free(files);
+
+  fclose(fptr);
+
+  if(rename(tempname,filename))
+  {
+    fprintf(stderr,"Could not move checkpoint into place at %s\n",filename);
+    exit(1);
+  }
+}
+
+int load_checkpoint(char *filename, struct Orbit *orbit, struct Data **data, struct Model ***model, struct Chain *chain, struct Flags *flags, struct Proposal ***proposal, struct Convergence *conv, int *mcmc, int *cycle)
+{
+  int NC = chain->NC;
+
+  FILE *fptr = fopen(filename,"rb");
+  if(fptr==NULL)
+  {
+    //nothing to resume from, start over with empty chain files
+    fprintf(stdout,"No checkpoint at %s, starting a new run\n",filename);
+    truncate_chain_files(chain, flags, NULL);
+    return 0;
+  }
+
+  long header[CHECKPOINT_HEADER];
+  long expect[CHECKPOINT_HEADER];
+  checkpoint_header(data, model, chain, flags, conv, expect);
+  read_block(header, sizeof(long), CHECKPOINT_HEADER, fptr, filename);
+  for(int n=0; n<CHECKPOINT_HEADER; n++)
+  {
+    if(header[n]!=expect[n])
+    {
+      fprintf(stderr,"Checkpoint %s does not match this run (header entry %i is %li, expected %li)\n",filename,n,header[n],expect[n]);
+      fprintf(stderr,"Resume with the command line that wrote it\n");
+      exit(1);
+    }
+  }
+
+  read_block(mcmc,  sizeof(int), 1, fptr, filename);
+  read_block(cycle, sizeof(int), 1, fptr, filename);
+
+  read_block(&flags->NMCMC, sizeof(int), 1, fptr, filename);
+  for(int i=0; i<flags->NDATA; i++) read_block(&data[i]->downsample, sizeof(int), 1, fptr, filename);
+
+  read_block(chain->index,       sizeof(int),    NC, fptr, filename);
+  read_block(chain->temperature, sizeof(double), NC, fptr, filename);
+  read_block(chain->acceptance,  sizeof(double), NC, fptr, filename);
+  read_block(chain->avgLogL,     sizeof(double), NC, fptr, filename);
+  for(int ic=0; ic<NC; ic++) read_block(chain->dimension[ic], sizeof(int), flags->DMAX, fptr, filename);
+  read_block(&chain->logLmax,   sizeof(double), 1, fptr, filename);
+  read_block(&chain->annealing, sizeof(double), 1, fptr, filename);
+  read_block(chain->direction,    sizeof(int),    NC, fptr, filename);
+  read_block(chain->roundTrips,   sizeof(int),    NC, fptr, filename);
+  read_block(chain->swapTrial,    sizeof(int),    NC, fptr, filename);
+  read_block(chain->swapReject,   sizeof(double), NC, fptr, filename);
+  read_block(&chain->ladderRound, sizeof(int),    1,  fptr, filename);
+
+  for(int i=0; i<flags->NDATA; i++)
+  {
+    for(int k=0; k<chain->NP+1; k++)
+    {
+      read_block(proposal[i][k]->trial,   sizeof(int),    NC, fptr, filename);
+      read_block(proposal[i][k]->accept,  sizeof(int),    NC, fptr, filename);
+      read_block(proposal[i][k]->time,    sizeof(double), NC, fptr, filename);
+      read_block(&proposal[i][k]->weight, sizeof(double), 1,  fptr, filename);
+    }
+    set_proposal_table(proposal[i], chain->NP);
+  }
+
+  //restore parameters, then rebuild everything derived from them
+  double *state  = malloc(header[12]*sizeof(double));
+  double *fisher = malloc(header[13]*sizeof(double));
+  for(int ic=0; ic<NC; ic++)
+  {
+    for(int i=0; i<flags->NDATA; i++)
+    {
+      struct Model *model_ptr = model[ic][i];
+
+      read_block(state,  sizeof(double), header[12], fptr, filename);
+      read_block(fisher, sizeof(double), header[13], fptr, filename);
+
+      unpack_model_state(model_ptr, state, data[i]->T);
+      generate_noise_model(data[i], model_ptr);
+      generate_signal_model(orbit, data[i], model_ptr, -1);
+      if(flags->calibration)
+      {
+        generate_calibration_model(data[i], model_ptr);
+        apply_calibration_model(data[i], model_ptr);
+      }
+      unpack_fisher_state(model_ptr, fisher);
+      history_state(model_ptr, fptr, filename, 0);
+    }
+  }
+  free(state);
+  free(fisher);
+
+  for(int i=0; i<flags->NDATA; i++) waveform_samples(data[i], fptr, filename, 0);
+
+  read_block(&conv->n,      sizeof(int), 1, fptr, filename);
+  read_block(&conv->stride, sizeof(int), 1, fptr, filename);
+  read_block(&conv->count,  sizeof(int), 1, fptr, filename);
+  for(int k=0; k<conv->K; k++) read_block(conv->x[k], sizeof(double), conv->n, fptr, filename);
+
+  //drop whatever was written to the chain files after the checkpoint
+  long *offset = malloc((6+flags->DMAX+3*NC)*sizeof(long));
+  FILE **files = malloc((6+flags->DMAX+3*NC)*sizeof(FILE *));
+  int Nfiles = chain_file_list(chain, flags, files);
+  read_block(offset, sizeof(long), Nfiles, fptr, filename);
+  truncate_chain_files(chain, flags, offset);
+  free(offset);
+  free(files);
+
+  fclose(fptr);
+
+  fprintf(stdout,"Resuming from %s at step %i\n",filename,*mcmc);
+
+  return 1;
+}
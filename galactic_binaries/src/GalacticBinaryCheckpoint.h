@@ -0,0 +1,30 @@
+//
+//  GalacticBinaryCheckpoint.h
+//
+//
+//  Binary checkpoints of the full sampler state.
+//
+//
+
+#ifndef GalacticBinaryCheckpoint_h
+#define GalacticBinaryCheckpoint_h
+
+#include <stdio.h>
+
+/*
+ A checkpoint holds every model of every chain (with Fisher matrices and
+ differential evolution histories), the temperature ladder and index
+ permutation, proposal counters and weights, the saved waveform samples,
+ the convergence monitor, the iteration counters, and the length of each
+ chain file.  The random streams are keyed by iteration (see
+ GalacticBinaryRNG.h), so the iteration counter is their state.
+
+ Restoring a checkpoint regenerates each model's signal, noise and
+ calibration from its parameters and truncates the chain files back to
+ where they were, so a resumed run continues bit-for-bit.
+ */
+
+void save_checkpoint(char *filename, struct Data **data, struct Model ***model, struct Chain *chain, struct Flags *flags, struct Proposal ***proposal, struct Convergence *conv, int mcmc, int cycle);
+int  load_checkpoint(char *filename, struct Orbit *orbit, struct Data **data, struct Model ***model, struct Chain *chain, struct Flags *flags, struct Proposal ***proposal, struct Convergence *conv, int *mcmc, int *cycle);
+
+#endif /* GalacticBinaryCheckpoint_h */
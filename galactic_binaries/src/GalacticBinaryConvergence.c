@@ -0,0 +1,188 @@
+//
+//  GalacticBinaryConvergence.c
+//
+//
+//  Online autocorrelation time and effective sample size of the cold chain.
+//
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "LISA.h"
+#include "GalacticBinary.h"
+#include "GalacticBinaryConvergence.h"
+
+//window is grown until it is this many autocorrelation times long
+#define TAU_WINDOW 5.0
+
+//estimate is trusted once the chain is this many autocorrelation times long
+#define TAU_RELIABLE 50.0
+
+static const char *parameter_names[] = {"f0","costheta","phi","logA","cosi","cos4psi","cos2phi0","fdot","fddot"};
+
+void alloc_convergence(struct Convergence *conv, int K, int Nmax)
+{
+  conv->K    = K;
+  conv->Nmax = Nmax;
+
+  conv->x = malloc(K*sizeof(double *));
+  for(int k=0; k<K; k++) conv->x[k] = malloc(Nmax*sizeof(double));
+  conv->tau      = malloc(K*sizeof(double));
+  conv->ess      = malloc(K*sizeof(double));
+  conv->reliable = malloc(K*sizeof(int));
+
+  reset_convergence(conv);
+}
+
+void reset_convergence(struct Convergence *conv)
+{
+  conv->n      = 0;
+  conv->stride = 1;
+  conv->count  = 0;
+  for(int k=0; k<conv->K; k++)
+  {
+    conv->tau[k]      = 0.0;
+    conv->ess[k]      = 0.0;
+    conv->reliable[k] = 0;
+  }
+}
+
+void free_convergence(struct Convergence *conv)
+{
+  for(int k=0; k<conv->K; k++) free(conv->x[k]);
+  free(conv->x);
+  free(conv->tau);
+  free(conv->ess);
+  free(conv->reliable);
+}
+
+void convergence_sample(struct Model **model, int NDATA, int NP, double *sample)
+{
+  int Nlive = 0;
+
+  sample[0] = 0.0;
+  for(int j=0; j<NP; j++) sample[2+j] = 0.0;
+
+  for(int i=0; i<NDATA; i++)
+  {
+    sample[0] += model[i]->logL + model[i]->logLnorm;
+    for(int n=0; n<model[i]->Nlive; n++)
+    {
+      for(int j=0; j<NP; j++)
+      {
+        double p = model[i]->source[n]->params[j];
+
+        //the chain hops freely between psi+pi/2, phi0+pi (same waveform)
+        if(j==5) p = cos(4.*p);
+        if(j==6) p = cos(2.*p);
+
+        sample[2+j] += p;
+      }
+    }
+    Nlive += model[i]->Nlive;
+  }
+
+  sample[1] = (double)Nlive;
+  if(Nlive>0) for(int j=0; j<NP; j++) sample[2+j] /= (double)Nlive;
+}
+
+void update_convergence(struct Convergence *conv, double *sample)
+{
+  if(conv->count%conv->stride==0)
+  {
+    //buffer is full, keep every other sample and double the stride
+    if(conv->n==conv->Nmax)
+    {
+      for(int k=0; k<conv->K; k++)
+        for(int m=0; m<conv->Nmax/2; m++) conv->x[k][m] = conv->x[k][2*m];
+      conv->n /= 2;
+      conv->stride *= 2;
+    }
+
+    if(conv->count%conv->stride==0)
+    {
+      for(int k=0; k<conv->K; k++) conv->x[k][conv->n] = sample[k];
+      conv->n++;
+    }
+  }
+  conv->count++;
+}
+
+static double integrated_autocorrelation_time(double *x, int n, int *reliable)
+{
+  //quantity never changed (e.g. fixed dimension or pinned sky location)
+  int constant = 1;
+  for(int m=1; m<n; m++) if(x[m]!=x[0]) constant = 0;
+  if(constant)
+  {
+    *reliable = 1;
+    return 1.0;
+  }
+
+  double mean = 0.0;
+  for(int m=0; m<n; m++) mean += x[m];
+  mean /= (double)n;
+
+  double c0 = 0.0;
+  for(int m=0; m<n; m++) c0 += (x[m]-mean)*(x[m]-mean);
+
+  //sum the autocorrelation function over a window of M lags
+  double tau = 1.0;
+  int M;
+  for(M=1; M<n; M++)
+  {
+    double ct = 0.0;
+    for(int m=0; m<n-M; m++) ct += (x[m]-mean)*(x[m+M]-mean);
+    tau += 2.0*ct/c0;
+    if((double)M >= TAU_WINDOW*tau) break;
+  }
+  if(tau<1.0) tau = 1.0;
+
+  *reliable = (M<n && (double)n >= TAU_RELIABLE*tau);
+
+  return tau;
+}
+
+int check_convergence(struct Convergence *conv, double target)
+{
+  int converged = 1;
+
+  if(conv->n<2) return 0;
+
+  for(int k=0; k<conv->K; k++)
+  {
+    double tau = integrated_autocorrelation_time(conv->x[k], conv->n, &conv->reliable[k]);
+
+    //tau was measured in buffered samples
+    conv->tau[k] = tau*(double)conv->stride;
+    conv->ess[k] = (double)conv->count/conv->tau[k];
+
+    if(conv->ess[k] < target || !conv->reliable[k]) converged = 0;
+  }
+
+  return (target>0.0 && converged);
+}
+
+void print_convergence(struct Convergence *conv, char *filename, int mcmc, double target)
+{
+  FILE *fptr = fopen(filename,"w");
+  if(fptr==NULL)
+  {
+    fprintf(stderr,"Could not open %s\n",filename);
+    exit(1);
+  }
+
+  fprintf(fptr,"# step %i, post burn-in samples %i, target ESS %g\n",mcmc,conv->count,target);
+  fprintf(fptr,"# quantity tau ESS reliable\n");
+  for(int k=0; k<conv->K; k++)
+  {
+    if(k==0)      fprintf(fptr,"logL ");
+    else if(k==1) fprintf(fptr,"Nlive ");
+    else          fprintf(fptr,"%s ",parameter_names[k-2]);
+    fprintf(fptr,"%lg %lg %i\n",conv->tau[k],conv->ess[k],conv->reliable[k]);
+  }
+
+  fclose(fptr);
+}
@@ -0,0 +1,49 @@
+//
+//  GalacticBinaryConvergence.h
+//
+//
+//  Online autocorrelation time and effective sample size of the cold chain.
+//
+//
+
+#ifndef GalacticBinaryConvergence_h
+#define GalacticBinaryConvergence_h
+
+#include <stdio.h>
+
+/*
+ Tracked quantities are the cold chain's log likelihood, its number of
+ sources, and each source parameter averaged over the live sources (the
+ average does not care how the sources are labeled).  Polarization and
+ phase enter as cos(4 psi) and cos(2 phi0), which do not change under the
+ exact psi+pi/2, phi0+pi degeneracy.
+
+ Post burn-in samples go into a fixed-size buffer.  When the buffer fills
+ every other sample is dropped and the stride doubles, so the buffer
+ always spans the whole post burn-in chain.  The integrated
+ autocorrelation time is estimated from the buffer with Sokal's adaptive
+ window.
+ */
+struct Convergence
+{
+  int K;        //number of tracked quantities
+  int Nmax;     //buffer length
+  int n;        //samples in buffer
+  int stride;   //iterations between buffered samples
+  int count;    //iterations seen since burn-in
+  double **x;   //buffered samples [quantity][sample]
+  double *tau;  //integrated autocorrelation time (iterations)
+  double *ess;  //effective sample size
+  int *reliable;//is the chain much longer than tau?
+};
+
+void alloc_convergence(struct Convergence *conv, int K, int Nmax);
+void reset_convergence(struct Convergence *conv);
+void free_convergence(struct Convergence *conv);
+
+void convergence_sample(struct Model **model, int NDATA, int NP, double *sample);
+void update_convergence(struct Convergence *conv, double *sample);
+int  check_convergence(struct Convergence *conv, double target);
+void print_convergence(struct Convergence *conv, char *filename, int mcmc, double target);
+
+#endif /* GalacticBinaryConvergence_h */
@@ -21,6 +21,7 @@
 #include "GalacticBinaryData.h"
 #include "GalacticBinaryMath.h"
 #include "GalacticBinaryModel.h"
+#include "GalacticBinaryRNG.h"
 #include "GalacticBinaryWaveform.h"
 
 void GalacticBinaryReadData(struct Data **data_vec, struct Orbit *orbit, struct Flags *flags)
@@ -30,12 +31,6 @@ void GalacticBinaryReadData(struct Data **data_vec, struct Orbit *orbit, struct
   struct Data *data = data_vec[0];
   struct TDI *tdi = data->tdi[0];
 
-  //set RNG for noise
-  const gsl_rng_type *T = gsl_rng_default;
-  gsl_rng *r = gsl_rng_alloc(T);
-  gsl_rng_env_setup();
-  gsl_rng_set (r, data->iseed);
-
   //find first frequency bin of data segment
   //set bandwidth of data segment centered on injection
   data->fmax = data->fmin + data->N/data->T;
@@ -43,7 +38,6 @@ void GalacticBinaryReadData(struct Data **data_vec, struct Orbit *orbit, struct
   data->qmax = data->qmin+data->N;
   
   double f, junk;
-  char filename[128];
   
 
   //burn off low frequency bins
@@ -59,6 +53,20 @@ void GalacticBinaryReadData(struct Data **data_vec, struct Orbit *orbit, struct
     fscanf(fptr,"%lg %lg %lg %lg %lg",&f,&tdi->A[2*n],&tdi->A[2*n+1],&tdi->E[2*n],&tdi->E[2*n+1]);
   }
   fclose(fptr);
+  
+  GalacticBinarySetupData(data_vec, orbit, flags);
+}
+
+void GalacticBinarySetupData(struct Data **data_vec, struct Orbit *orbit, struct Flags *flags)
+{
+  struct Data *data = data_vec[0];
+  struct TDI *tdi = data->tdi[0];
+  
+  FILE *fptr;
+  char filename[128];
+  
+  //set RNG for noise
+  gsl_rng *r = alloc_rng_stream(data->nseed, 0, 0, 0, RNG_NOISE);
 
   //TODO: LDC data needs a factor of 1/sqrt(2) normalization?
   /*
@@ -137,14 +145,15 @@ void GalacticBinaryReadData(struct Data **data_vec, struct Orbit *orbit, struct
   }
   
   //Add Gaussian noise to injection
-  gsl_rng_set (r, data->nseed+0);
-  
   if(!flags->zeroNoise)
   {
     printf("   ...adding Gaussian noise realization\n");
     
     for(int n=0; n<data->N; n++)
     {
+      //key the noise by absolute frequency bin so overlapping segments agree
+      set_rng_stream(r, data->nseed, 0, 0, data->qmin+n, RNG_NOISE);
+      
       tdi->A[2*n]   += gsl_ran_gaussian (r, sqrt(data->noise[0]->SnA[n])/2.);
       tdi->A[2*n+1] += gsl_ran_gaussian (r, sqrt(data->noise[0]->SnA[n])/2.);
       
@@ -201,6 +210,8 @@ void GalacticBinaryReadData(struct Data **data_vec, struct Orbit *orbit, struct
     tdi->X[2*n]   = tdi->A[2*n];
     tdi->X[2*n+1] = tdi->A[2*n+1];
   }
+  
+  gsl_rng_free(r);
 }
 
 
@@ -238,10 +249,7 @@ void GalacticBinaryInjectVerificationSource(struct Data **data_vec, struct Orbit
     //draw extrinsic parameters
     
     //set RNG for injection
-    const gsl_rng_type *T = gsl_rng_default;
-    gsl_rng *r = gsl_rng_alloc(T);
-    gsl_rng_env_setup();
-    gsl_rng_set (r, data_vec[ii]->iseed);
+    gsl_rng *r = alloc_rng_stream(data_vec[ii]->iseed, 0, 0, 0, RNG_INJECTION);
     
     //TODO: support for verification binary priors
     cosi = -1.0 + gsl_rng_uniform(r)*2.0;
@@ -384,7 +392,7 @@ void GalacticBinaryInjectVerificationSource(struct Data **data_vec, struct Orbit
       fprintf(stdout,"   ...injected SNR=%g\n",snr(inj, data->noise[jj]));
       
       //Add Gaussian noise to injection
-      gsl_rng_set (r, data->nseed+jj);
+      set_rng_stream(r, data->nseed, 0, jj, 0, RNG_NOISE);
       
       if(!flags->zeroNoise)
       {
@@ -436,7 +444,6 @@ void GalacticBinaryInjectVerificationSource(struct Data **data_vec, struct Orbit
         fprintf(fptr,"\n");
       }
       fclose(fptr);
-      fclose(injectionFile);
 
       sprintf(filename,"data/data_%i_%i.dat",ii,jj);
       fptr=fopen(filename,"w");
@@ -460,6 +467,7 @@ void GalacticBinaryInjectVerificationSource(struct Data **data_vec, struct Orbit
       }
 
     }//end jj loop over time segments
+    fclose(injectionFile);
     gsl_rng_free(r);
   }
   
@@ -506,10 +514,7 @@ void GalacticBinaryInjectSimulatedSource(struct Data **data_vec, struct Orbit *o
     N--;
     
     //set RNG for injection
-    const gsl_rng_type *T = gsl_rng_default;
-    gsl_rng *r = gsl_rng_alloc(T);
-    gsl_rng_env_setup();
-    gsl_rng_set (r, data_vec[ii]->iseed);
+    gsl_rng *r = alloc_rng_stream(data_vec[ii]->iseed, 0, 0, 0, RNG_INJECTION);
     
     for(int nn=0; nn<N; nn++)
     {
@@ -665,7 +670,7 @@ void GalacticBinaryInjectSimulatedSource(struct Data **data_vec, struct Orbit *o
         fprintf(stdout,"   ...injected SNR=%g\n",snr(inj, data->noise[jj]));
         
         //Add Gaussian noise to injection
-        gsl_rng_set (r, data->nseed+jj);
+        set_rng_stream(r, data->nseed, 0, jj, 0, RNG_NOISE);
         
         if(!flags->zeroNoise && nn==0)
         {
@@ -12,6 +12,7 @@
 #include <stdio.h>
 
 void GalacticBinaryReadData(struct Data **data_vec, struct Orbit *orbit, struct Flags *flags);
+void GalacticBinarySetupData(struct Data **data_vec, struct Orbit *orbit, struct Flags *flags);
 void GalacticBinarySimulateData(struct Data *data);
 void GalacticBinaryInjectVerificationSource(struct Data **data_vec, struct Orbit *orbit, struct Flags *flags);
 void GalacticBinaryInjectSimulatedSource(struct Data **data_vec, struct Orbit *orbit, struct Flags *flags);
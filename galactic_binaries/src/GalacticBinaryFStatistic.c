@@ -28,10 +28,15 @@ void initialize_XLS(long M, double *XLS, double *AA, double *EE)
   }
 }
 
-void init_A_filters(struct Orbit *orbit, struct Data *data, struct Filter *F_filter)
+struct Filter *setup_Fstat_filter(long M_filter)
 {
-  long M = F_filter->M_filter;
-
+  long M = M_filter;
+  
+  struct Filter *F_filter = malloc(sizeof(struct Filter));
+  
+  F_filter->M_filter = M_filter;
+  F_filter->N_filter = M_filter;
+  
   F_filter->A1_fX = malloc((2*M)*sizeof(double));
   F_filter->A2_fX = malloc((2*M)*sizeof(double));
   F_filter->A3_fX = malloc((2*M)*sizeof(double));
@@ -47,6 +52,23 @@ void init_A_filters(struct Orbit *orbit, struct Data *data, struct Filter *F_fil
   F_filter->A3_fE = malloc((2*M)*sizeof(double));
   F_filter->A4_fE = malloc((2*M)*sizeof(double));
   
+  F_filter->M_inv_X  = malloc(4*sizeof(double *));
+  F_filter->M_inv_AE = malloc(4*sizeof(double *));
+  for(int i=0; i<4; i++)
+  {
+    F_filter->M_inv_X[i]  = malloc(4*sizeof(double));
+    F_filter->M_inv_AE[i] = malloc(4*sizeof(double));
+  }
+  
+  F_filter->wave = alloc_waveform_workspace((int)M_filter);
+  
+  return F_filter;
+}
+
+void init_A_filters(struct Orbit *orbit, struct Data *data, struct Filter *F_filter)
+{
+  long M = F_filter->M_filter;
+
   initialize_XLS(M, F_filter->A1_fX, F_filter->A1_fA, F_filter->A1_fE);
   initialize_XLS(M, F_filter->A2_fX, F_filter->A2_fA, F_filter->A2_fE);
   initialize_XLS(M, F_filter->A3_fX, F_filter->A3_fA, F_filter->A3_fE);
@@ -92,13 +114,8 @@ void init_M_matrix(struct Filter *F_filter, struct Data *data)
 {
   long i,j;
   
-  F_filter->M_inv_X  = malloc(4*sizeof(double *));//dmatrix(0,3,0,3);
-  F_filter->M_inv_AE = malloc(4*sizeof(double *));//dmatrix(0,3,0,3);
   for(i=0; i<4; i++)
   {
-    F_filter->M_inv_X[i]  = malloc(4*sizeof(double));//dmatrix(0,3,0,3);
-    F_filter->M_inv_AE[i] = malloc(4*sizeof(double));//dmatrix(0,3,0,3);
-
     for (j=0;j<4;j++)
     {
       F_filter->M_inv_X[i][j]  = 0.0;
@@ -134,6 +151,10 @@ void free_Filter(struct Filter *F_filter)
   }
   free(F_filter->M_inv_X);
   free(F_filter->M_inv_AE);
+  
+  free_waveform_workspace(F_filter->wave);
+  
+  free(F_filter);
 }
 
 void get_filters(struct Orbit *orbit, struct Data *data, int filter_id, struct Filter *F_filter)
@@ -141,12 +162,11 @@ void get_filters(struct Orbit *orbit, struct Data *data, int filter_id, struct F
   int i;
   int d=9;
   double A_f,iota_f,psi_f,phase_f;
-  double *params;
+  double params[9];
   long M_filter;
   
   M_filter = F_filter->M_filter;
   
-  params = malloc(d*sizeof(double));  // allocate memory for filter parameters
   for (i=0;i<d;i++)  		 // initialize the array to zeros
   {
     params[i] = 0.0;
@@ -192,7 +212,7 @@ void get_filters(struct Orbit *orbit, struct Data *data, int filter_id, struct F
     // map to conventions for waveform generator
     //params[3]=log(params[3]);
     params[4]=cos(params[4]);
-    galactic_binary(orbit, data->format, data->T, data->t0[0], params, 9, F_filter->A1_fX, F_filter->A1_fA, F_filter->A1_fE, M_filter, 2);
+    galactic_binary_workspace(orbit, data->format, data->T, data->t0[0], params, 9, F_filter->A1_fX, F_filter->A1_fA, F_filter->A1_fE, M_filter, 2, F_filter->wave);
     
   } else if (filter_id == 2){
     
@@ -211,7 +231,7 @@ void get_filters(struct Orbit *orbit, struct Data *data, int filter_id, struct F
     // map to conventions for waveform generator
     //params[3]=log(params[3]);
     params[4]=cos(params[4]);
-    galactic_binary(orbit, data->format, data->T, data->t0[0], params, 9, F_filter->A2_fX, F_filter->A2_fA, F_filter->A2_fE, M_filter, 2);
+    galactic_binary_workspace(orbit, data->format, data->T, data->t0[0], params, 9, F_filter->A2_fX, F_filter->A2_fA, F_filter->A2_fE, M_filter, 2, F_filter->wave);
     
   } else if (filter_id == 3){
     
@@ -230,7 +250,7 @@ void get_filters(struct Orbit *orbit, struct Data *data, int filter_id, struct F
     // map to conventions for waveform generator
     //params[3]=log(params[3]);
     params[4]=cos(params[4]);
-    galactic_binary(orbit, data->format, data->T, data->t0[0], params, 9, F_filter->A3_fX, F_filter->A3_fA, F_filter->A3_fE, M_filter, 2);
+    galactic_binary_workspace(orbit, data->format, data->T, data->t0[0], params, 9, F_filter->A3_fX, F_filter->A3_fA, F_filter->A3_fE, M_filter, 2, F_filter->wave);
     
   } else {
     
@@ -249,10 +269,8 @@ void get_filters(struct Orbit *orbit, struct Data *data, int filter_id, struct F
     // map to conventions for waveform generator
     //params[3]=log(params[3]);
     params[4]=cos(params[4]);
-    galactic_binary(orbit, data->format, data->T, data->t0[0], params, 9, F_filter->A4_fX, F_filter->A4_fA, F_filter->A4_fE, M_filter, 2);
+    galactic_binary_workspace(orbit, data->format, data->T, data->t0[0], params, 9, F_filter->A4_fX, F_filter->A4_fA, F_filter->A4_fE, M_filter, 2, F_filter->wave);
   }
-  
-  free(params);
 }
 
 void get_N(struct Data *data, struct Filter *F_filter)
@@ -548,20 +566,12 @@ void calc_a_i(struct Filter *F_filter)
   +F_filter->M_inv_AE[3][2]*F_filter->N3_AE + F_filter->M_inv_AE[3][3]*F_filter->N4_AE;
 }
 
-void get_Fstat_logL(struct Orbit *orbit, struct Data *data, double f0, double fdot, double theta, double phi, double *logL_X, double *logL_AE, double *Fparams)
+void get_Fstat_logL(struct Orbit *orbit, struct Data *data, struct Filter *F_filter, double f0, double fdot, double theta, double phi, double *logL_X, double *logL_AE, double *Fparams)
 {
-  long M_filter, N_filter;
-  M_filter = 64;
-  N_filter = 64;
   long q;
   
   q = (long)(f0*data->T); 	// carrier frequency bin
   
-  struct Filter *F_filter = malloc(sizeof(struct Filter));
-  
-  F_filter->M_filter = M_filter;
-  F_filter->N_filter = N_filter;
-  
   F_filter->f0     = f0;
   F_filter->fdot   = fdot;
   F_filter->fddot  = 0.;    //11.0/3.0*fdot*fdot/f0 
@@ -600,8 +610,223 @@ void get_Fstat_logL(struct Orbit *orbit, struct Data *data, double f0, double fd
   Fparams[1] = F_filter->iota_AE_Fstat;
   Fparams[2] = F_filter->psi_AE_Fstat;
   Fparams[3] = F_filter->phase_AE_Fstat;
+}
+
+
+/*
+ FFT F-statistic engine
+ -At fixed sky location and fdot the filters for neighbouring
+  frequencies differ (to a good approximation) only by a shift
+  in frequency bin, so (s|A^i) and (A^i|A^j) across the band
+  are correlations of one kernel with the whitened data and
+  inverse noise.
+ -Each kernel is built at the center of a span of bins and
+  reused over the whole span, one kernel per sub-bin offset.
+ -Larger spans are cheaper but the filters drift further from
+  their exact values at the span edges.
+ */
+struct FstatFFT *setup_Fstat_fft(struct Data *data)
+{
+  struct FstatFFT *fft = malloc(sizeof(struct FstatFFT));
   
-  free_Filter(F_filter);
+  fft->M_filter = FSTAT_BW;
+  
+  //zero pad so shifts running off either end of the band don't wrap
+  fft->L = 1;
+  while(fft->L < data->N + fft->M_filter) fft->L *= 2;
+  
+  //complex arrays, unit offset for dfour1
+  fft->wX = calloc(2*fft->L+1,sizeof(double));
+  fft->wA = calloc(2*fft->L+1,sizeof(double));
+  fft->wE = calloc(2*fft->L+1,sizeof(double));
+  fft->gX = calloc(2*fft->L+1,sizeof(double));
+  fft->gA = calloc(2*fft->L+1,sizeof(double));
+  
+  //same bins and weights as get_N() and get_M()
+  for(int k=1; k<data->N; k++)
+  {
+    fft->wX[2*k+1] = data->tdi[FIXME]->X[2*k]  /data->noise[FIXME]->SnX[k];
+    fft->wX[2*k+2] = data->tdi[FIXME]->X[2*k+1]/data->noise[FIXME]->SnX[k];
+    fft->wA[2*k+1] = data->tdi[FIXME]->A[2*k]  /data->noise[FIXME]->SnA[k];
+    fft->wA[2*k+2] = data->tdi[FIXME]->A[2*k+1]/data->noise[FIXME]->SnA[k];
+    fft->wE[2*k+1] = data->tdi[FIXME]->E[2*k]  /data->noise[FIXME]->SnA[k];
+    fft->wE[2*k+2] = data->tdi[FIXME]->E[2*k+1]/data->noise[FIXME]->SnA[k];
+    fft->gX[2*k+1] = 1./data->noise[FIXME]->SnX[k];
+    fft->gA[2*k+1] = 1./data->noise[FIXME]->SnA[k];
+  }
+  
+  dfour1(fft->wX, fft->L, 1);
+  dfour1(fft->wA, fft->L, 1);
+  dfour1(fft->wE, fft->L, 1);
+  dfour1(fft->gX, fft->L, 1);
+  dfour1(fft->gA, fft->L, 1);
+  
+  return fft;
 }
 
+void free_Fstat_fft(struct FstatFFT *fft)
+{
+  free(fft->wX);
+  free(fft->wA);
+  free(fft->wE);
+  free(fft->gX);
+  free(fft->gA);
+  free(fft);
+}
+
+//c[s] = sum_m a[s+m] conj(b[m]) from the transforms of a and b (overwrites b)
+static void fft_correlate(double *a, double *b, long L)
+{
+  for(long n=1; n<=L; n++)
+  {
+    double re = a[2*n-1]*b[2*n-1] + a[2*n]*b[2*n];
+    double im = a[2*n]*b[2*n-1] - a[2*n-1]*b[2*n];
+    b[2*n-1] = re/(double)L;
+    b[2*n]   = im/(double)L;
+  }
+  dfour1(b, L, -1);
+}
+
+void get_Fstat_logL_fft(struct Orbit *orbit, struct Data *data, struct FstatFFT *fft, double fdot, double theta, double phi, int nsub, int span, double *logL_X, double *logL_AE)
+{
+  long L = fft->L;
+  long M = fft->M_filter;
+  
+  //upper triangle of M^{ij}, packed two elements per complex correlation
+  int pair[10][2] = {{0,0},{0,1},{0,2},{0,3},{1,1},{1,2},{1,3},{2,2},{2,3},{3,3}};
+  
+  double *kX = malloc((2*L+1)*sizeof(double));
+  double *kA = malloc((2*L+1)*sizeof(double));
+  double *kE = malloc((2*L+1)*sizeof(double));
+  double *NX[4], *NAE[4], *MX[5], *MAE[5];
+  for(int i=0; i<4; i++)
+  {
+    NX[i]  = malloc((2*L+1)*sizeof(double));
+    NAE[i] = malloc((2*L+1)*sizeof(double));
+  }
+  for(int i=0; i<5; i++)
+  {
+    MX[i]  = malloc((2*L+1)*sizeof(double));
+    MAE[i] = malloc((2*L+1)*sizeof(double));
+  }
+  
+  struct Filter *F_filter = setup_Fstat_filter(M);
+  F_filter->fdot     = fdot;
+  F_filter->fddot    = 0.;
+  F_filter->theta    = theta;
+  F_filter->phi      = phi;
 
+  for(int b0=0; b0<data->N; b0+=span)
+  {
+    int nb = (span < data->N-b0) ? span : data->N-b0;
+    
+    for(int r=0; r<nsub; r++)
+    {
+      //kernel at the center of the span
+      F_filter->f0 = ((double)(data->qmin + b0 + nb/2) + (double)r/(double)nsub)/data->T;
+      F_filter->q  = (long)(F_filter->f0*data->T);
+      
+      init_A_filters(orbit, data, F_filter);
+      
+      double *A[4][3] =
+      {
+        {F_filter->A1_fX, F_filter->A1_fA, F_filter->A1_fE},
+        {F_filter->A2_fX, F_filter->A2_fA, F_filter->A2_fE},
+        {F_filter->A3_fX, F_filter->A3_fA, F_filter->A3_fE},
+        {F_filter->A4_fX, F_filter->A4_fA, F_filter->A4_fE}
+      };
+      
+      //N^{i} = (s|A^{i}) at every shift of the kernel
+      for(int i=0; i<4; i++)
+      {
+        for(long n=1; n<=2*L; n++) kX[n] = kA[n] = kE[n] = 0.0;
+        for(long m=0; m<2*M; m++)
+        {
+          kX[m+1] = A[i][0][m];
+          kA[m+1] = A[i][1][m];
+          kE[m+1] = A[i][2][m];
+        }
+        dfour1(kX, L, 1);
+        dfour1(kA, L, 1);
+        dfour1(kE, L, 1);
+        
+        for(long n=1; n<=2*L; n++)
+        {
+          NX[i][n]  = kX[n];
+          NAE[i][n] = kA[n];
+        }
+        fft_correlate(fft->wX, NX[i], L);
+        fft_correlate(fft->wA, NAE[i], L);
+        fft_correlate(fft->wE, kE, L);
+        for(long n=1; n<=2*L; n++) NAE[i][n] += kE[n];
+      }
+      
+      //M^{ij} = (A^{i}|A^{j}) at every shift of the kernel
+      for(int p=0; p<5; p++)
+      {
+        for(long n=1; n<=2*L; n++) MX[p][n] = MAE[p][n] = 0.0;
+        for(long m=0; m<M; m++)
+        {
+          for(int c=0; c<2; c++)
+          {
+            double *ai = A[pair[2*p+c][0]][0], *aj = A[pair[2*p+c][1]][0];
+            double *ei = A[pair[2*p+c][0]][1], *ej = A[pair[2*p+c][1]][1];
+            double *fi = A[pair[2*p+c][0]][2], *fj = A[pair[2*p+c][1]][2];
+            MX[p][2*m+1+c]  = ai[2*m]*aj[2*m] + ai[2*m+1]*aj[2*m+1];
+            MAE[p][2*m+1+c] = ei[2*m]*ej[2*m] + ei[2*m+1]*ej[2*m+1]
+                            + fi[2*m]*fj[2*m] + fi[2*m+1]*fj[2*m+1];
+          }
+        }
+        dfour1(MX[p],  L, 1);
+        dfour1(MAE[p], L, 1);
+        fft_correlate(fft->gX, MX[p],  L);
+        fft_correlate(fft->gA, MAE[p], L);
+      }
+      
+      //F-statistic for each bin of the span
+      for(int b=b0; b<b0+nb; b++)
+      {
+        long s = b - M/2;
+        if(s<0) s += L;
+        long n = 2*s+1;
+        
+        F_filter->N1_X  = 4.0*NX[0][n];  F_filter->N1_AE = 4.0*NAE[0][n];
+        F_filter->N2_X  = 4.0*NX[1][n];  F_filter->N2_AE = 4.0*NAE[1][n];
+        F_filter->N3_X  = 4.0*NX[2][n];  F_filter->N3_AE = 4.0*NAE[2][n];
+        F_filter->N4_X  = 4.0*NX[3][n];  F_filter->N4_AE = 4.0*NAE[3][n];
+        
+        //real part holds the first of each packed pair, -imaginary part the second
+        for(int p=0; p<10; p++)
+        {
+          int i = pair[p][0];
+          int j = pair[p][1];
+          double sign = (p%2==0) ? 1.0 : -1.0;
+          F_filter->M_inv_X[i][j]  = F_filter->M_inv_X[j][i]  = 4.0*sign*MX[p/2][n+p%2];
+          F_filter->M_inv_AE[i][j] = F_filter->M_inv_AE[j][i] = 4.0*sign*MAE[p/2][n+p%2];
+        }
+        invert_matrix(F_filter->M_inv_X,4);
+        invert_matrix(F_filter->M_inv_AE,4);
+        
+        calc_Fstat_logL(F_filter);
+        
+        logL_X[b*nsub+r]  = F_filter->Fstat_X;
+        logL_AE[b*nsub+r] = F_filter->Fstat_AE;
+      }
+    }
+  }
+  
+  free_Filter(F_filter);
+  free(kX);
+  free(kA);
+  free(kE);
+  for(int i=0; i<4; i++)
+  {
+    free(NX[i]);
+    free(NAE[i]);
+  }
+  for(int i=0; i<5; i++)
+  {
+    free(MX[i]);
+    free(MAE[i]);
+  }
+}
@@ -14,6 +14,15 @@
 
 #include <stdio.h>
 
+#define FSTAT_BW 64 //frequency bins in each F-statistic filter
+
+/*
+ F-statistic context
+ -filter buffers, M^{ij} scratch and waveform workspace are
+  allocated once by setup_Fstat_filter() and reused by every
+  get_Fstat_logL() call made with it
+ -not safe to share between threads
+ */
 struct Filter
 {
   double *A1_fX, *A1_fA, *A1_fE;
@@ -44,6 +53,17 @@ struct Filter
   long   q;
   double theta, phi;
   
+  struct Workspace *wave;
+};
+
+struct FstatFFT
+{
+  long L;        //length of zero-padded correlations
+  long M_filter; //bins in each filter
+  
+  //transforms of whitened data and inverse noise
+  double *wX, *wA, *wE;
+  double *gX, *gA;
 };
 
 void initialize_XLS(long M, double *XLS, double *AA, double *EE);
@@ -63,6 +83,7 @@ void init_A_filters(struct Orbit *orbit, struct Data *data, struct Filter *F_fil
 
 void init_M_matrix(struct Filter *F_filter, struct Data *data);
 
+struct Filter *setup_Fstat_filter(long M_filter);
 void free_Filter(struct Filter *F_filter);
 
 
@@ -70,7 +91,11 @@ void get_F_params(struct Filter *F_filter);
 
 int sgn(double v);
 
-void get_Fstat_logL(struct Orbit *orbit, struct Data *data, double f0, double fdot, double theta, double phi, double *logL_X, double *logL_AE, double *Fparams);
+void get_Fstat_logL(struct Orbit *orbit, struct Data *data, struct Filter *F_filter, double f0, double fdot, double theta, double phi, double *logL_X, double *logL_AE, double *Fparams);
+
+struct FstatFFT *setup_Fstat_fft(struct Data *data);
+void free_Fstat_fft(struct FstatFFT *fft);
+void get_Fstat_logL_fft(struct Orbit *orbit, struct Data *data, struct FstatFFT *fft, double fdot, double theta, double phi, int nsub, int span, double *logL_X, double *logL_AE);
 
 
 #endif /* GalacticBinaryFStatistic_h */
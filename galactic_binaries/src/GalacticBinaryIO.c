@@ -16,6 +16,10 @@
 #include <gsl/gsl_sort.h>
 #include <gsl/gsl_statistics.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "LISA.h"
 #include "GalacticBinary.h"
 #include "GalacticBinaryIO.h"
@@ -72,9 +76,13 @@ void print_usage()
   fprintf(stdout,"       --steps       : number of mcmc steps (10000)        \n");
   fprintf(stdout,"       --samples     : number of frequency bins (2048)     \n");
   fprintf(stdout,"       --segments    : number of data segments (1)         \n");
+  fprintf(stdout,"       --threads     : number of threads (OMP_NUM_THREADS) \n");
   fprintf(stdout,"       --start-time  : initial time of segment  (0)        \n");
   fprintf(stdout,"       --gap-time    : duration of data gaps (0)           \n");
   fprintf(stdout,"       --fmin        : minimum frequency                   \n");
+  fprintf(stdout,"       --fmax        : maximum frequency (gb_global)       \n");
+  fprintf(stdout,"       --padding     : window overlap in bins (32)         \n");
+  fprintf(stdout,"       --cadence     : steps between edge handoffs (100)   \n");
   fprintf(stdout,"       --duration    : duration of time segment (62914560) \n");
   fprintf(stdout,"       --noiseseed   : seed for noise RNG                  \n");
   fprintf(stdout,"       --chainseed   : seed for MCMC RNG                   \n");
@@ -90,13 +98,27 @@ void print_usage()
   fprintf(stdout,"       --known-source: injection is VB (draw orientation)  \n");
   fprintf(stdout,"       --detached    : detached binary(i.e., use Mc prior) \n");
   fprintf(stdout,"       --cheat       : start chain at injection parameters \n");
-  fprintf(stdout,"       --update      : use chain as proposal [filename]    \n");
+  fprintf(stdout,"       --update      : chain or mixture proposal [filename]\n");
   fprintf(stdout,"       --zero-noise  : data w/out noise realization        \n");
   fprintf(stdout,"       --conf-noise  : include model for confusion noise   \n");
   fprintf(stdout,"       --f-double-dot: include f double dot in model       \n");
   fprintf(stdout,"       --links       : number of links [4->X,6->AE] (6)    \n");
   fprintf(stdout,"       --no-rj       : used fixed dimension                \n");
+  fprintf(stdout,"       --dr          : delayed rejection mode hopping      \n");
+  fprintf(stdout,"       --mtm         : candidates per multiple-try move    \n");
+  fprintf(stdout,"       --deo         : non-reversible even/odd chain swaps \n");
+  fprintf(stdout,"       --tune-ladder : equalize swap rejection in burn-in  \n");
+  fprintf(stdout,"       --hot-steps   : fewest updates/iteration hot chains \n");
+  fprintf(stdout,"       --fstat-fft   : bins per FFT F-stat kernel (exact)  \n");
+  fprintf(stdout,"       --fstat-refine: levels of F-stat grid refinement (0)\n");
+  fprintf(stdout,"       --cache       : directory to reuse F-stat grids from\n");
+  fprintf(stdout,"       --fisher-refresh: Fisher distance moved between updates\n");
+  fprintf(stdout,"       --adapt-weights: least proposal weight in burn-in re-weighting\n");
   fprintf(stdout,"       --fit-gap     : fit for time gaps between segments  \n");
+  fprintf(stdout,"       --checkpoint  : steps between checkpoints (1000)    \n");
+  fprintf(stdout,"       --resume      : continue from last checkpoint       \n");
+  fprintf(stdout,"       --target-ess  : stop early at this effective size   \n");
+  fprintf(stdout,"       --walltime    : seconds to finish in (sets steps)   \n");
   fprintf(stdout,"       --calibration : marginalize over calibration errors \n");
   fprintf(stdout,"       --prior       : sample from prior                   \n");
   fprintf(stdout,"       --debug       : leaner settings for quick running   \n");
@@ -123,6 +145,16 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
   //Set defaults
   flags->calibration = 0;
   flags->rj          = 1;
+  flags->dr          = 0;
+  flags->mtm         = 0;
+  flags->deo         = 0;
+  flags->tuneLadder  = 0;
+  flags->hotSteps    = 100;
+  flags->fstatFFT    = 0;
+  flags->fstatRefine = 0;
+  flags->fisherRefresh = 0.0;
+  flags->adaptWeights  = 0.0;
+  flags->cacheDir[0] = '\0';
   flags->verbose     = 0;
   flags->NDATA       = 1;
   flags->NINJ        = 0;
@@ -138,6 +170,17 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
   flags->strainData  = 0;
   flags->knownSource = 0;
   flags->NT          = 1;
+#ifdef _OPENMP
+  flags->threads     = omp_get_max_threads();
+#else
+  flags->threads     = 1;
+#endif
+  flags->padding     = 32;
+  flags->cadence     = 100;
+  flags->checkpoint  = 1000;
+  flags->resume      = 0;
+  flags->targetESS   = 0;
+  flags->walltime    = 0;
   flags->orbit       = 0;
   flags->prior       = 0;
   flags->update      = 0;
@@ -145,7 +188,7 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
   flags->DMAX        = Dmax;
   flags->NMCMC       = 10000;
   flags->NBURN       = 10000;
-  chain->NP          = 5; //number of proposals
+  chain->NP          = 6; //number of proposals
   chain->NC          = 12;//number of chains
   
   
@@ -168,6 +211,8 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
     }
     
     data[i]->T        = 62914560.0; /* two "mldc years" at 15s sampling */
+    data[i]->fmin     = 0.0;
+    data[i]->fmax     = 0.0;
     data[i]->N        = 1024;
     data[i]->NP       = 8; //default includes fdot
     data[i]->Nchannel = 2; //1=X, 2=AE
@@ -189,6 +234,7 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
     {"samples",   required_argument, 0, 0},
     {"duration",  required_argument, 0, 0},
     {"segments",  required_argument, 0, 0},
+    {"threads",   required_argument, 0, 0},
     {"start-time",required_argument, 0, 0},
     {"gap-time",  required_argument, 0, 0},
     {"orbit",     required_argument, 0, 0},
@@ -199,10 +245,23 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
     {"inj",       required_argument, 0, 0},
     {"data",      required_argument, 0, 0},
     {"fmin",      required_argument, 0, 0},
+    {"fmax",      required_argument, 0, 0},
+    {"padding",   required_argument, 0, 0},
+    {"cadence",   required_argument, 0, 0},
     {"links",     required_argument, 0, 0},
     {"update",    required_argument, 0, 0},
     {"steps",     required_argument, 0, 0},
     {"em-prior",  required_argument, 0, 0},
+    {"checkpoint",required_argument, 0, 0},
+    {"target-ess",required_argument, 0, 0},
+    {"hot-steps", required_argument, 0, 0},
+    {"mtm",       required_argument, 0, 0},
+    {"fstat-fft", required_argument, 0, 0},
+    {"fstat-refine", required_argument, 0, 0},
+    {"fisher-refresh", required_argument, 0, 0},
+    {"adapt-weights", required_argument, 0, 0},
+    {"cache",     required_argument, 0, 0},
+    {"walltime",  required_argument, 0, 0},
     
     /* These options don’t set a flag.
      We distinguish them by their indices. */
@@ -221,8 +280,12 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
     {"cheat",       no_argument, 0, 0 },
     {"debug",       no_argument, 0, 0 },
     {"no-rj",       no_argument, 0, 0 },
+    {"dr",          no_argument, 0, 0 },
+    {"deo",         no_argument, 0, 0 },
+    {"tune-ladder", no_argument, 0, 0 },
     {"fit-gap",     no_argument, 0, 0 },
     {"calibration", no_argument, 0, 0 },
+    {"resume",      no_argument, 0, 0 },
     {0, 0, 0, 0}
   };
   
@@ -239,9 +302,22 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
       case 0:
         if(strcmp("samples",     long_options[long_index].name) == 0) data_ptr->N       = atoi(optarg);
         if(strcmp("segments",    long_options[long_index].name) == 0) flags->NT         = atoi(optarg);
+        if(strcmp("threads",     long_options[long_index].name) == 0) flags->threads    = atoi(optarg);
         if(strcmp("duration",    long_options[long_index].name) == 0) data_ptr->T       = (double)atof(optarg);
         if(strcmp("start-time",  long_options[long_index].name) == 0) data_ptr->t0[0]   = (double)atof(optarg);
         if(strcmp("fmin",        long_options[long_index].name) == 0) data_ptr->fmin    = (double)atof(optarg);
+        if(strcmp("fmax",        long_options[long_index].name) == 0) data_ptr->fmax    = (double)atof(optarg);
+        if(strcmp("padding",     long_options[long_index].name) == 0) flags->padding    = atoi(optarg);
+        if(strcmp("cadence",     long_options[long_index].name) == 0) flags->cadence    = atoi(optarg);
+        if(strcmp("checkpoint",  long_options[long_index].name) == 0) flags->checkpoint = atoi(optarg);
+        if(strcmp("target-ess",  long_options[long_index].name) == 0) flags->targetESS  = atoi(optarg);
+        if(strcmp("hot-steps",   long_options[long_index].name) == 0) flags->hotSteps   = atoi(optarg);
+        if(strcmp("mtm",         long_options[long_index].name) == 0) flags->mtm        = atoi(optarg);
+        if(strcmp("fstat-fft",   long_options[long_index].name) == 0) flags->fstatFFT   = atoi(optarg);
+        if(strcmp("fstat-refine",long_options[long_index].name) == 0) flags->fstatRefine= atoi(optarg);
+        if(strcmp("fisher-refresh",long_options[long_index].name) == 0) flags->fisherRefresh = (double)atof(optarg);
+        if(strcmp("adapt-weights",long_options[long_index].name) == 0) flags->adaptWeights = (double)atof(optarg);
+        if(strcmp("walltime",    long_options[long_index].name) == 0) flags->walltime   = atoi(optarg);
         if(strcmp("gap-time",    long_options[long_index].name) == 0) data_ptr->tgap[0] = (double)atof(optarg);
         if(strcmp("chains",      long_options[long_index].name) == 0) chain->NC         = atoi(optarg);
         if(strcmp("chainseed",   long_options[long_index].name) == 0) data_ptr->cseed   = (long)atoi(optarg);
@@ -258,8 +334,12 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
         if(strcmp("cheat",       long_options[long_index].name) == 0) flags->cheat      = 1;
         if(strcmp("debug",       long_options[long_index].name) == 0) flags->debug      = 1;
         if(strcmp("no-rj",       long_options[long_index].name) == 0) flags->rj         = 0;
+        if(strcmp("dr",          long_options[long_index].name) == 0) flags->dr         = 1;
+        if(strcmp("deo",         long_options[long_index].name) == 0) flags->deo        = 1;
+        if(strcmp("tune-ladder", long_options[long_index].name) == 0) flags->tuneLadder = 1;
         if(strcmp("fit-gap",     long_options[long_index].name) == 0) flags->gap        = 1;
         if(strcmp("calibration", long_options[long_index].name) == 0) flags->calibration= 1;
+        if(strcmp("resume",      long_options[long_index].name) == 0) flags->resume     = 1;
         if(strcmp("em-prior",    long_options[long_index].name) == 0)
         {
           flags->emPrior = 1;
@@ -305,6 +385,10 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
             exit(1);
           }
         }
+        if(strcmp("cache", long_options[long_index].name) == 0)
+        {
+          sprintf(flags->cacheDir,"%s",optarg);
+        }
         if(strcmp("update", long_options[long_index].name) == 0)
         {
           checkfile(optarg);
@@ -342,6 +426,46 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
     }
   }
   if(flags->cheat) flags->NBURN = 0;
+  if(flags->walltime < 0)
+  {
+    fprintf(stderr,"--walltime must not be negative\n");
+    exit(1);
+  }
+  if(flags->mtm < 0)
+  {
+    fprintf(stderr,"--mtm must not be negative\n");
+    exit(1);
+  }
+  if(flags->hotSteps < 1)
+  {
+    fprintf(stderr,"--hot-steps must be at least 1\n");
+    exit(1);
+  }
+  if(flags->threads < 1)
+  {
+    fprintf(stderr,"--threads must be at least 1\n");
+    exit(1);
+  }
+  if(flags->fstatFFT < 0)
+  {
+    fprintf(stderr,"--fstat-fft must not be negative\n");
+    exit(1);
+  }
+  if(flags->fstatRefine < 0)
+  {
+    fprintf(stderr,"--fstat-refine must not be negative\n");
+    exit(1);
+  }
+  if(flags->fisherRefresh < 0.0)
+  {
+    fprintf(stderr,"--fisher-refresh must not be negative\n");
+    exit(1);
+  }
+  if(flags->adaptWeights < 0.0 || flags->adaptWeights >= 0.2)
+  {
+    fprintf(stderr,"--adapt-weights must be in [0,0.2)\n");
+    exit(1);
+  }
 
   // copy command line args to other data structures
   for(int i=0; i<flags->NDATA; i++)
@@ -383,6 +507,7 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
   mode_t process_mask = umask(0);
   mkdir("chains",S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
   mkdir("data",S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+  mkdir("checkpoint",S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
   umask(process_mask);
   
   //Print command line
@@ -429,6 +554,11 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
   fprintf(stdout,"  MCMC steps............%i   \n",flags->NMCMC);
   fprintf(stdout,"  MCMC burnin steps.....%i   \n",flags->NBURN);
   fprintf(stdout,"  MCMC chain seed ..... %li  \n",data_ptr->cseed);
+  fprintf(stdout,"  Threads ............. %i   \n",flags->threads);
+  fprintf(stdout,"  Checkpoint steps .... %i   \n",flags->checkpoint);
+  fprintf(stdout,"  Target ESS .......... %i   \n",flags->targetESS);
+  fprintf(stdout,"  Wall time ........... %i   \n",flags->walltime);
+  fprintf(stdout,"  Hot chain steps ..... %i   \n",flags->hotSteps);
   fprintf(stdout,"\n");
   fprintf(stdout,"================= RUN FLAGS ================\n");
   if(flags->verbose)  fprintf(stdout,"  Verbose flag ........ ENABLED \n");
@@ -459,13 +589,57 @@ void parse(int argc, char **argv, struct Data **data, struct Orbit *orbit, struc
   }
   if(flags->rj)       fprintf(stdout,"  RJMCMC is ........... ENABLED\n");
   else                fprintf(stdout,"  RJMCMC is ........... DISABLED\n");
+  if(flags->dr)       fprintf(stdout,"  Delayed rejection is.. ENABLED\n");
+  else                fprintf(stdout,"  Delayed rejection is.. DISABLED\n");
+  if(flags->mtm)      fprintf(stdout,"  Multiple-try moves... %i candidates\n",flags->mtm);
+  else                fprintf(stdout,"  Multiple-try moves... DISABLED\n");
+  if(flags->fstatFFT) fprintf(stdout,"  FFT F-statistic ..... %i bins/kernel\n",flags->fstatFFT);
+  else                fprintf(stdout,"  FFT F-statistic ..... DISABLED\n");
+  if(flags->fstatRefine) fprintf(stdout,"  F-statistic grid .... %i refinements\n",flags->fstatRefine);
+  else                fprintf(stdout,"  F-statistic grid .... UNIFORM\n");
+  if(flags->cacheDir[0]!='\0') fprintf(stdout,"  F-statistic cache ... %s\n",flags->cacheDir);
+  else                          fprintf(stdout,"  F-statistic cache ... DISABLED\n");
+  if(flags->fisherRefresh>0.0) fprintf(stdout,"  Fisher refresh ...... moved %g\n",flags->fisherRefresh);
+  else                          fprintf(stdout,"  Fisher refresh ...... EVERY 100\n");
+  if(flags->adaptWeights>0.0) fprintf(stdout,"  Proposal weights .... ADAPTED (least %g)\n",flags->adaptWeights);
+  else                         fprintf(stdout,"  Proposal weights .... FIXED\n");
+  if(flags->deo)      fprintf(stdout,"  Even/odd swaps are... ENABLED\n");
+  else                fprintf(stdout,"  Even/odd swaps are... DISABLED\n");
+  if(flags->tuneLadder) fprintf(stdout,"  Ladder tuning is..... ENABLED\n");
+  else                  fprintf(stdout,"  Ladder tuning is..... DISABLED\n");
   if(flags->detached) fprintf(stdout,"  Mchirp prior is...... ENABLED\n");
   else                fprintf(stdout,"  Mchirp prior is...... DISABLED\n");
+  if(flags->resume)   fprintf(stdout,"  Resume is ........... ENABLED\n");
+  else                fprintf(stdout,"  Resume is ........... DISABLED\n");
   fprintf(stdout,"\n");
   fprintf(stdout,"\n");
   
 }
 
+void print_ladder(struct Chain *chain, struct Flags *flags, char *filename, int step)
+{
+  FILE *fptr = fopen(filename,"w");
+  if(fptr==NULL)
+  {
+    fprintf(stderr,"Could not open %s\n",filename);
+    exit(1);
+  }
+  
+  int total = 0;
+  for(int ic=0; ic<chain->NC; ic++) total += chain->roundTrips[ic];
+  
+  fprintf(fptr,"# step %i, round trips %i\n",step,total);
+  fprintf(fptr,"# chain temperature rejection(ic,ic+1) round_trips(replica ic) steps\n");
+  for(int ic=0; ic<chain->NC; ic++)
+  {
+    double reject = 0.0;
+    if(chain->swapTrial[ic]>0) reject = chain->swapReject[ic]/(double)chain->swapTrial[ic];
+    fprintf(fptr,"%i %lg %lg %i %i\n",ic,chain->temperature[ic],reject,chain->roundTrips[ic],temperature_steps(chain,flags,ic));
+  }
+  
+  fclose(fptr);
+}
+
 void print_chain_files(struct Data *data, struct Model ***model, struct Chain *chain, struct Flags *flags, int step)
 {
   int i,j,n,ic;
@@ -1,3 +1,10 @@
+//
+//  GalacticBinaryMCMC.c
+//
+//
+//  Created by Littenberg, Tyson B. (MSFC-ZP12) on 1/15/17.
+//
+//
 
 /***************************  REQUIRED LIBRARIES  ***************************/
 
@@ -10,343 +17,27 @@
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_randist.h>
 
-//#include "omp.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-/*************  PROTOTYPE DECLARATIONS FOR INTERNAL FUNCTIONS  **************/
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
 
 #include "LISA.h"
 #include "Constants.h"
-#include "BayesLine.h"
 #include "GalacticBinary.h"
 #include "GalacticBinaryIO.h"
 #include "GalacticBinaryData.h"
 #include "GalacticBinaryPrior.h"
 #include "GalacticBinaryModel.h"
 #include "GalacticBinaryProposal.h"
+#include "GalacticBinaryRNG.h"
 #include "GalacticBinaryWaveform.h"
+#include "GalacticBinaryMCMC.h"
 
-
-void ptmcmc(struct Model ***model, struct Chain *chain, struct Flags *flags);
-void adapt_temperature_ladder(struct Chain *chain, int mcmc);
-
-void galactic_binary_mcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic);
-void galactic_binary_drmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic);
-void galactic_binary_rjmcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic);
-
-void data_mcmc(struct Orbit *orbit, struct Data **data, struct Model **model, struct Chain *chain, struct Flags *flags, struct Proposal **proposal, int ic);
-void noise_model_mcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, int ic);
-
-/* ============================  MAIN PROGRAM  ============================ */
-
-int main(int argc, char *argv[])
-{
-  
-  int ic;
-  
-  time_t start, stop;
-  start = time(NULL);
-  
-  int NMAX = 10;   //max number of frequency & time segments
-  int DMAX = 20;   //100; //max number of GB waveforms
-  
-  /* Allocate data structures */
-  struct Flags *flags = malloc(sizeof(struct Flags));
-  struct Orbit *orbit = malloc(sizeof(struct Orbit));
-  struct Chain *chain = malloc(sizeof(struct Chain));
-  struct Data  **data = malloc(sizeof(struct Data*)*NMAX); //data[NF]
-
-  
-  /* Parse command line and set defaults/flags */
-  for(int i=0; i<NMAX; i++)
-  {
-    data[i] = malloc(sizeof(struct Data));
-    data[i]->t0   = malloc( NMAX * sizeof(double) );
-    data[i]->tgap = malloc( NMAX * sizeof(double) );
-  }
-  parse(argc,argv,data,orbit,flags,chain,NMAX,DMAX);
-  int NC = chain->NC;
-  
-  
-  /* Allocate model structures */
-  struct Model **trial = malloc(sizeof(struct Model*)*NC);//trial[chain]
-  struct Model ***model= malloc(sizeof(struct Model**)*NC); //model[chain][source][segment]
-  
-  /* Load spacecraft ephemerides */
-  switch(flags->orbit)
-  {
-    case 0:
-      initialize_analytic_orbit(orbit);
-      break;
-    case 1:
-      initialize_numeric_orbit(orbit);
-      break;
-    default:
-      fprintf(stderr,"unsupported orbit type\n");
-      return(1);
-      break;
-  }
-  
-  /* Initialize data structures */
-  alloc_data(data, flags);
-
-  /* Inject strain data */
-  if(flags->strainData)
-  {
-    GalacticBinaryReadData(data,orbit,flags);
-  }
-  else
-  {
-    /* Inject gravitational wave signal */
-    if(flags->knownSource)
-      GalacticBinaryInjectVerificationSource(data,orbit,flags);
-    else
-      GalacticBinaryInjectSimulatedSource(data,orbit,flags);
-  }
-  
-  /* Initialize data-dependent proposal */
-  setup_frequency_proposal(data[0]);
-  
-  /* Initialize parallel chain */
-  initialize_chain(chain, flags, &data[0]->cseed);
-  
-  /* Initialize MCMC proposals */
-  printf("chain->NP=%i\n",chain->NP);
-  struct Proposal ***proposal = malloc(NMAX*sizeof(struct Proposal**));
-  for(int j=0; j<NMAX; j++)
-  {
-    proposal[j] = malloc((chain->NP+1)*sizeof(struct Proposal*));
-    for(int i=0; i<chain->NP+1; i++) proposal[j][i] = malloc(sizeof(struct Proposal));
-  
-  }
-  for(int j=0; j<flags->NDATA; j++) initialize_proposal(orbit, data[j], chain, flags, proposal[j], DMAX);
-
-  /* Initialize priors */
-  struct Prior *prior = malloc(sizeof(struct Prior));
-  if(flags->galaxyPrior) set_galaxy_prior(flags, prior);
-
-  
-  /* Initialize data models */
-  for(ic=0; ic<NC; ic++)
-  {
-    //printf("initialize model\n");
-
-    trial[ic] = malloc(sizeof(struct Model));
-    alloc_model(trial[ic],DMAX,data[0]->N,data[0]->Nchannel,data[0]->NP, data[0]->NT);
-    
-    model[ic] = malloc(sizeof(struct Model *) * flags->NDATA);
-    
-    //loop over frequency segments
-    for(int i=0; i<flags->NDATA; i++)
-    {
-      //printf("frequency segment %i\n",i);
-
-      model[ic][i] = malloc(sizeof(struct Model));
-      
-      struct Model *model_ptr = model[ic][i];
-      struct Data  *data_ptr  = data[i];
-      
-      alloc_model(model_ptr,DMAX,data_ptr->N,data_ptr->Nchannel, data_ptr->NP, flags->NT);
-      
-      if(ic==0)set_uniform_prior(flags, model_ptr, data_ptr, 1);
-      else     set_uniform_prior(flags, model_ptr, data_ptr, 0);
-      
-      //set noise model
-      for(int j=0; j<flags->NT; j++) copy_noise(data_ptr->noise[j], model_ptr->noise[j]);
-      
-      //set signal model
-      for(int n=0; n<DMAX; n++)
-      {
-
-        if(flags->cheat)
-        {
-          struct Source *inj = data_ptr->inj;
-          //map parameters to vector
-          model_ptr->source[n]->NP       = inj->NP;
-          model_ptr->source[n]->f0       = inj->f0;
-          model_ptr->source[n]->dfdt     = inj->dfdt;
-          model_ptr->source[n]->costheta = inj->costheta;
-          model_ptr->source[n]->phi      = inj->phi;
-          model_ptr->source[n]->amp      = inj->amp;
-          model_ptr->source[n]->cosi     = inj->cosi;
-          model_ptr->source[n]->phi0     = inj->phi0;
-          model_ptr->source[n]->psi      = inj->psi;
-          model_ptr->source[n]->d2fdt2   = inj->d2fdt2;
-          map_params_to_array(model_ptr->source[n], model_ptr->source[n]->params, data_ptr->T);
-          
-        }
-        else if(flags->update)
-        {
-          draw_from_cdf(data_ptr, model_ptr, model_ptr->source[n], proposal[i][6], model_ptr->source[n]->params , chain->r[ic]);
-        }
-        else
-        {
-          draw_from_prior(data_ptr, model_ptr, model_ptr->source[n], proposal[i][0], model_ptr->source[n]->params , chain->r[ic]);
-        }
-        map_array_to_params(model_ptr->source[n], model_ptr->source[n]->params, data_ptr->T);
-        galactic_binary_fisher(orbit, data_ptr, model_ptr->source[n], data_ptr->noise[0]);
-      }
-      
-      // Form master model & compute likelihood of starting position
-      generate_noise_model(data_ptr, model_ptr);
-      generate_signal_model(orbit, data_ptr, model_ptr, -1);
-
-      //calibration error
-      if(flags->calibration)
-      {
-        draw_calibration_parameters(data_ptr, model_ptr, chain->r[ic]);
-        generate_calibration_model(data_ptr, model_ptr);
-        apply_calibration_model(data_ptr, model_ptr);
-      }
-      if(!flags->prior)
-      {
-        model_ptr->logL     = gaussian_log_likelihood(orbit, data_ptr, model_ptr);
-        model_ptr->logLnorm = gaussian_log_likelihood_constant_norm(data_ptr, model_ptr);
-      }
-      else model_ptr->logL = model_ptr->logLnorm = 0.0;
-      
-      if(ic==0) chain->logLmax += model_ptr->logL + model_ptr->logLnorm;
-      
-    }//end loop over frequency segments
-  }//end loop over chains
-  
-  
-  /* The MCMC loop */
-  for(int mcmc = -flags->NBURN; mcmc < flags->NMCMC; mcmc++)
-  {
-    if(mcmc<0) flags->burnin=1;
-    else       flags->burnin=0;
-    
-    //set annealinging tempurature during burnin
-    /*
-    if(flags->burnin)
-    {
-      chain->annealing = data[0]->SNR2*pow(data[0]->SNR2,-((double)mcmc+(double)flags->NBURN)/((double)flags->NBURN/(double)10))/40.;
-      if(chain->annealing<1.0)chain->annealing=1.0;
-      chain->annealing=1.0;
-      //printf("annealing=%g\n",chain->annealing);
-    }
-     */
-    chain->annealing=1.0;
-    
-    // (parallel) loop over chains
-    //#pragma omp parallel for private(ic) shared(flags,model,trial,chain,orbit,proposal)
-    for(ic=0; ic<NC; ic++)
-    {
-      
-      //loop over frequency segments
-      for(int i=0; i<flags->NDATA; i++)
-      {
-        struct Model *model_ptr = model[chain->index[ic]][i];
-        struct Model *trial_ptr = trial[chain->index[ic]];
-        struct Data  *data_ptr  = data[i];
-        
-        
-        for(int steps=0; steps < 100; steps++)
-        {
-          //for(int j=0; j<model_ptr->Nlive; j++)
-          galactic_binary_mcmc(orbit, data_ptr, model_ptr, trial_ptr, chain, flags, prior, proposal[i], ic);
-
-          noise_model_mcmc(orbit, data_ptr, model_ptr, trial_ptr, chain, flags, ic);
-        }//loop over MCMC steps
-        
-        
-        //reverse jump birth/death move
-        if(flags->rj)galactic_binary_rjmcmc(orbit, data_ptr, model_ptr, trial_ptr, chain, flags, prior, proposal[i], ic);
-
-        //delayed rejection mode-hopper
-        /*
-         if(model_ptr->Nlive>0 && mcmc<0 && ic<NC/2)galactic_binary_drmc(orbit, data_ptr, model_ptr, trial_ptr, chain, flags, prior, proposal[i], ic);
-         */
-
-        //update fisher matrix for each chain
-        if(mcmc%100==0)
-        {
-          for(int n=0; n<model_ptr->Nlive; n++)
-          {
-            galactic_binary_fisher(orbit, data_ptr, model_ptr->source[n], data_ptr->noise[FIXME]);
-          }
-        }
-      }//end loop over frequency segments
-      
-      //update start time for data segments
-      if(flags->gap) data_mcmc(orbit, data, model[chain->index[ic]], chain, flags, proposal[0], ic);
-      
-    }// end (parallel) loop over chains
-    
-    ptmcmc(model,chain,flags);
-    adapt_temperature_ladder(chain, mcmc+flags->NBURN);
-    
-    print_chain_files(data[FIXME], model, chain, flags, mcmc);
-    
-    //track maximum log Likelihood
-    if(mcmc%100)
-    {
-      if(update_max_log_likelihood(model, chain, flags)) mcmc = -flags->NBURN;
-    }
-    
-    //store reconstructed waveform
-    print_waveform_draw(data, model[chain->index[0]], flags);
-    
-    //update run status
-    if(mcmc%data[FIXME]->downsample==0)
-    {
-      for(int i=0; i<flags->NDATA; i++)
-      {
-        print_chain_state(data[i], chain, model[chain->index[0]][i], flags, stdout, mcmc);
-        fprintf(stdout,"Sources: %i\n",model[chain->index[0]][i]->Nlive);
-        print_acceptance_rates(proposal[i], chain->NP, 0, stdout);
-      }
-    }
-    
-    //dump waveforms to file, update avgLogL for thermodynamic integration
-    if(mcmc>0 && mcmc%data[FIXME]->downsample==0)
-    {
-      for(int i=0; i<flags->NDATA; i++)save_waveforms(data[i], model[chain->index[0]][i], mcmc/data[i]->downsample);
-      for(ic=0; ic<NC; ic++)
-      {
-        chain->dimension[ic][model[chain->index[ic]][0]->Nlive]++;
-        for(int i=0; i<flags->NDATA; i++)
-          chain->avgLogL[ic] += model[chain->index[ic]][i]->logL + model[chain->index[ic]][i]->logLnorm;
-      }
-    }
-    
-  }// end MCMC loop
-  
-  //print aggregate run files/results
-  for(int i=0; i<flags->NDATA; i++)print_waveforms_reconstruction(data[i],i);
-  
-  FILE *chainFile = fopen("avg_log_likelihood.dat","w");
-  for(ic=0; ic<NC; ic++) fprintf(chainFile,"%lg %lg\n",1./chain->temperature[ic],chain->avgLogL[ic]/(double)(flags->NMCMC/data[FIXME]->downsample));
-  fclose(chainFile);
-  
-  FILE *zFile = fopen("evidence.dat","w");
-  for(int i=0; i<DMAX; i++) fprintf(zFile,"%i %i\n",i,chain->dimension[0][i]);
-  fclose(zFile);
-  
-  //print total run time
-  stop = time(NULL);
-  
-  if(flags->verbose) printf(" ELAPSED TIME = %g second\n",(double)(stop-start));
-  
-  
-  //free memory and exit cleanly
-  for(ic=0; ic<NC; ic++)
-  {
-    for(int i=0; i<flags->NDATA; i++) free_model(model[ic][i]);
-    free_model(trial[ic]);
-  }
-  if(flags->orbit)free_orbit(orbit);
-  //free_noise(data[0]->noise[FIXME]);
-  //free_tdi(data[0]->tdi[FIXME]);
-  free_chain(chain,flags);
-  //free(model[FIXME][FIXME]);
-  //free(trial[FIXME][FIXME]);
-  //free(data[0]);
-  
-  return 0;
-}
-
-void ptmcmc(struct Model ***model, struct Chain *chain, struct Flags *flags)
+void ptmcmc(struct Model ***model, struct Chain *chain, struct Flags *flags, int mcmc)
 {
   int a, b;
   int olda, oldb;
@@ -360,10 +51,18 @@ void ptmcmc(struct Model ***model, struct Chain *chain, struct Flags *flags)
   
   int NC = chain->NC;
   
+  //one random stream for all swaps of this iteration
+  gsl_rng *r = chain->r[0];
+  set_rng_stream(r, chain->seed, 0, 0, mcmc, RNG_SWAP);
+  
   //b = (int)(ran2(seed)*((double)(chain->NC-1)));
   for(b=NC-1; b>0; b--)
   {
     a = b - 1;
+    
+    //non-reversible schedule: pairs starting on even rungs on even iterations, odd on odd
+    if(flags->deo && a%2 != mcmc%2) continue;
+    
     chain->acceptance[a]=0;
     
     olda = chain->index[a];
@@ -381,13 +80,16 @@ void ptmcmc(struct Model ***model, struct Chain *chain, struct Flags *flags)
     }
     
     //Hot chains jump more rarely
-    if(gsl_rng_uniform(chain->r[a])<1.0)
+    if(gsl_rng_uniform(r)<1.0)
     {
       dlogL = logL2 - logL1;
       H  = (heat2 - heat1)/(heat2*heat1);
       
       alpha = exp(dlogL*H);
-      beta  = gsl_rng_uniform(chain->r[a]);
+      beta  = gsl_rng_uniform(r);
+      
+      chain->swapTrial[a]++;
+      if(alpha < 1.0) chain->swapReject[a] += 1.0 - alpha;
       
       if(alpha >= beta)
       {
@@ -397,6 +99,63 @@ void ptmcmc(struct Model ***model, struct Chain *chain, struct Flags *flags)
       }
     }
   }
+  
+  //a replica completes a round trip when it gets back to the cold chain from the hottest
+  if(NC>1)
+  {
+    int cold = chain->index[0];
+    int hot  = chain->index[NC-1];
+    if(chain->direction[cold] < 0) chain->roundTrips[cold]++;
+    chain->direction[cold] = 1;
+    chain->direction[hot]  = -1;
+  }
+}
+
+void tune_temperature_ladder(struct Chain *chain)
+{
+  int ic;
+  
+  int NC = chain->NC;
+  
+  if(NC<3) return;
+  for(ic=0; ic<NC-1; ic++) if(chain->swapTrial[ic] < chain->ladderRound) return;
+  
+  /*
+   Cumulative swap rejection rate Lambda(beta), linear between rungs.
+   Interior rungs are moved to equal steps in Lambda so every pair
+   rejects at the same rate; the cold and hottest chains stay put.
+   */
+  double beta[NC];
+  double Lambda[NC];
+  
+  Lambda[0] = 0.0;
+  for(ic=0; ic<NC-1; ic++)
+  {
+    beta[ic] = 1./chain->temperature[ic];
+    Lambda[ic+1] = Lambda[ic] + chain->swapReject[ic]/(double)chain->swapTrial[ic];
+  }
+  beta[NC-1] = 1./chain->temperature[NC-1];
+  
+  if(Lambda[NC-1] > 0.0)
+  {
+    int k = 0;
+    for(ic=1; ic<NC-1; ic++)
+    {
+      double target = Lambda[NC-1]*(double)ic/(double)(NC-1);
+      while(Lambda[k+1] < target) k++;
+      
+      double x = (target - Lambda[k])/(Lambda[k+1] - Lambda[k]);
+      chain->temperature[ic] = 1./(beta[k] + x*(beta[k+1] - beta[k]));
+    }
+  }
+  
+  //start a new (twice as long) round of swap statistics
+  for(ic=0; ic<NC; ic++)
+  {
+    chain->swapTrial[ic]  = 0;
+    chain->swapReject[ic] = 0.0;
+  }
+  chain->ladderRound *= 2;
 }
 
 void adapt_temperature_ladder(struct Chain *chain, int mcmc)
@@ -431,7 +190,7 @@ void adapt_temperature_ladder(struct Chain *chain, int mcmc)
   }//end loop over ic
 }//end adapt function
 
-void noise_model_mcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, int ic)
+void noise_model_mcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, int ic, gsl_rng *r)
 {
   double logH  = 0.0; //(log) Hastings ratio
   double loga  = 1.0; //(log) transition probability
@@ -451,11 +210,11 @@ void noise_model_mcmc(struct Orbit *orbit, struct Data *data, struct Model *mode
     switch(data->Nchannel)
     {
       case 1:
-        model_y->noise[i]->etaX = model_x->noise[i]->etaX + 0.1*gsl_ran_gaussian(chain->r[ic],1);
+        model_y->noise[i]->etaX = model_x->noise[i]->etaX + 0.1*gsl_ran_gaussian(r,1);
         break;
       case 2:
-        model_y->noise[i]->etaA = model_x->noise[i]->etaA + 0.1*gsl_ran_gaussian(chain->r[ic],1);
-        model_y->noise[i]->etaE = model_x->noise[i]->etaE + 0.1*gsl_ran_gaussian(chain->r[ic],1);
+        model_y->noise[i]->etaA = model_x->noise[i]->etaA + 0.1*gsl_ran_gaussian(r,1);
+        model_y->noise[i]->etaE = model_x->noise[i]->etaE + 0.1*gsl_ran_gaussian(r,1);
         break;
     }
     
@@ -490,12 +249,29 @@ void noise_model_mcmc(struct Orbit *orbit, struct Data *data, struct Model *mode
   }
   logH += logPy  - logPx;                                         //priors
   
-  loga = log(gsl_rng_uniform(chain->r[ic]));
+  loga = log(gsl_rng_uniform(r));
   if(logH > loga) copy_model(model_y,model_x);
   
 }
 
-void galactic_binary_mcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic)
+double wall_time(void)
+{
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/(double)CLOCKS_PER_SEC;
+#endif
+}
+
+//CPU seconds used so far by the calling thread
+static double thread_cpu_time(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return (double)t.tv_sec + 1.0e-9*(double)t.tv_nsec;
+}
+
+void galactic_binary_mcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic, gsl_rng *r)
 {
   double logH  = 0.0; //(log) Hastings ratio
   double loga  = 1.0; //(log) transition probability
@@ -512,7 +288,7 @@ void galactic_binary_mcmc(struct Orbit *orbit, struct Data *data, struct Model *
   copy_model(model_x,model_y);
   
   //pick a source to update
-  int n = (int)(gsl_rng_uniform(chain->r[ic])*(double)model_x->Nlive);
+  int n = (int)(gsl_rng_uniform(r)*(double)model_x->Nlive);
   
   //more shorthand pointers
   struct Source *source_x = model_x->source[n];
@@ -520,34 +296,26 @@ void galactic_binary_mcmc(struct Orbit *orbit, struct Data *data, struct Model *
   
   
   //choose proposal distribution
-  int trial_n;
-  double trial_w;
-  int nprop=0;
+  int nprop = select_proposal(proposal, chain->NP, r);
+  proposal[nprop]->trial[ic]++;
   
-  while(nprop<1)
+  //Fisher jumps since the source's Fisher matrix was computed
+  int fisher = (proposal[nprop]->id == PROPOSAL_FISHER);
+  if(fisher)
   {
-    trial_n = (int)floor((chain->NP+1)*gsl_rng_uniform(chain->r[ic]));
-    trial_w = gsl_rng_uniform(chain->r[ic]);
-    if(trial_w < proposal[trial_n]->weight) nprop = trial_n;
+    source_x->fisher_trial++;
+    source_y->fisher_trial++;
   }
-  proposal[nprop]->trial[ic]++;
+  
+  //cost of the move, from drawing y to accepting or rejecting it
+  double start = thread_cpu_time();
   
   //call proposal function to update source parameters
-  (*proposal[nprop]->function)(data, model_x, source_y, proposal[nprop], source_y->params, chain->r[ic]);
+  (*proposal[nprop]->draw)(data, model_x, source_y, proposal[nprop], source_y->params, r);
   
-  //evaluate proposal densities Qxy & Qyx
-  //TODO: Fix this
-  if(!strcmp(proposal[nprop]->name,"fstat"))
-  {
-    logQyx = evaluate_fstatistic_proposal(data, proposal[nprop], source_y->params);
-    logQxy = evaluate_fstatistic_proposal(data, proposal[nprop], source_x->params);
-  }
-  
-  if(!strcmp(proposal[nprop]->name,"cdf draw"))
-  {
-    logQyx = cdf_density(model_x, source_y, proposal[nprop]);
-    logQxy = cdf_density(model_x, source_x, proposal[nprop]);
-  }
+  //evaluate proposal densities Qxy & Qyx (zero for symmetric jumps)
+  logQyx = (*proposal[nprop]->density)(data, model_x, source_y, proposal[nprop], source_y->params);
+  logQxy = (*proposal[nprop]->density)(data, model_x, source_x, proposal[nprop], source_x->params);
   
   map_array_to_params(source_y, source_y->params, data->T);
   
@@ -560,7 +328,7 @@ void galactic_binary_mcmc(struct Orbit *orbit, struct Data *data, struct Model *
   }
   
   //update calibration parameters
-  if(flags->calibration) draw_calibration_parameters(data, model_y, chain->r[ic]);
+  if(flags->calibration) draw_calibration_parameters(data, model_y, r);
   /*
    no proposal density for calibration parameters
    because we are always drawing from prior...for now
@@ -602,31 +370,94 @@ void galactic_binary_mcmc(struct Orbit *orbit, struct Data *data, struct Model *
        */
       logH += (model_y->logL - model_x->logL)/chain->temperature[ic]; //delta logL
       if(flags->burnin) logH /= chain->annealing;
-              //if(!strcmp(proposal[nprop]->name,"cdf draw") && ic==0  && model_y->logL - model_x->logL < -20.)
-              //{
-              //  printf("cdf logH=%g, logLx=%g, logLy=%g\n",logH,model_x[i]->logL , model_y[i]->logL);
-              //  printf("   dlogQ=%g, logQxy=%g, logQyx=%g\n",logQxy - logQyx,logQxy,logQyx);
-             // }
     }
     logH += logPy  - logPx;  //priors
     logH += logQxy - logQyx; //proposals
     
-    loga = log(gsl_rng_uniform(chain->r[ic]));
+    loga = log(gsl_rng_uniform(r));
     if(logH > loga)
     {
-      if(!strcmp(proposal[nprop]->name,"cdf draw") && ic==0  && model_y->logL - model_x->logL < -20.)
-      {
-        printf("cdf logH=%g, logLx=%g, logLy=%g\n",logH,model_x->logL , model_y->logL);
-        printf("   dlogQ=%g, logQxy=%g, logQyx=%g\n",logQxy - logQyx,logQxy,logQyx);
-        //exit(1);
-      }
       proposal[nprop]->accept[ic]++;
+      if(fisher) source_y->fisher_accept++;
       copy_model(model_y,model_x);
     }
   }
+  
+  proposal[nprop]->time[ic] += thread_cpu_time() - start;
+}
+
+/*
+ Every 100 iterations each source's Fisher matrix is recomputed.
+ With --fisher-refresh only the sources that need it are: those that have
+ moved further than flags->fisherRefresh in the metric of their current
+ Fisher matrix, or whose Fisher jumps have mostly been rejected since.
+ The distance is per parameter and tempered, so it is in (hot) posterior
+ widths, and two draws from a converged chain are typically sqrt(2) apart.
+ */
+#define FISHER_MIN_JUMPS 50    //Fisher jumps before the acceptance is trusted
+#define FISHER_MIN_ACCEPT 0.05 //acceptance that triggers a refresh
+
+void update_fisher(struct Orbit *orbit, struct Data *data, struct Model *model, struct Chain *chain, struct Flags *flags, int ic, int mcmc)
+{
+  if(mcmc%100) return;
+  
+  for(int n=0; n<model->Nlive; n++)
+  {
+    struct Source *source = model->source[n];
+    
+    int stale = 1;
+    if(flags->fisherRefresh>0.0)
+    {
+      //squared distance moved, along each eigenvector of the Fisher matrix
+      //(directions at the eigenvalue floor of matrix_eigenstuff() are unconstrained)
+      double d2 = 0.0;
+      for(int i=0; i<source->NP; i++)
+      {
+        if(source->fisher_evalue[i] <= 10.0) continue;
+        double dx = 0.0;
+        for(int j=0; j<source->NP; j++) dx += source->fisher_evectr[j][i]*(source->params[j] - source->fisher_params[j]);
+        d2 += source->fisher_evalue[i]*dx*dx;
+      }
+      stale = (d2/(source->NP*chain->temperature[ic]) > flags->fisherRefresh*flags->fisherRefresh);
+      
+      if(source->fisher_trial >= FISHER_MIN_JUMPS && source->fisher_accept < FISHER_MIN_ACCEPT*source->fisher_trial) stale = 1;
+    }
+    
+    if(stale) galactic_binary_fisher(orbit, data, source, data->noise[FIXME]);
+  }
 }
 
-void galactic_binary_rjmcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic)
+/*
+ DE histories belong to sources, not to slots
+ -a birth starts an empty history in the new slot
+ -a death moves the histories down with the sources, and the
+  dead source's history goes to the slot that is freed
+ model and trial share each history, so both are updated
+ */
+static void move_histories(struct Model *model, struct Model *trial, int Nlive, int create, int kill)
+{
+  if(model->source[0]->history==NULL) return;
+  
+  if(create>=0)
+  {
+    model->source[create]->history->N    = 0;
+    model->source[create]->history->next = 0;
+  }
+  
+  if(kill>=0)
+  {
+    struct History *dead = model->source[kill]->history;
+    for(int j=kill; j<Nlive-1; j++)
+    {
+      model->source[j]->history = model->source[j+1]->history;
+      trial->source[j]->history = model->source[j]->history;
+    }
+    model->source[Nlive-1]->history = dead;
+    trial->source[Nlive-1]->history = dead;
+  }
+}
+
+void galactic_binary_rjmcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic, gsl_rng *r)
 {
   double logH  = 0.0; //(log) Hastings ratio
   double loga  = 1.0; //(log) transition probability
@@ -643,27 +474,32 @@ void galactic_binary_rjmcmc(struct Orbit *orbit, struct Data *data, struct Model
   copy_model(model_x,model_y);
   
   int freqflag=0;
-  if(gsl_rng_uniform(chain->r[ic])<0.5) freqflag=1;
+  if(gsl_rng_uniform(r)<0.5) freqflag=1;
+  
+  //slots of the source created or killed
+  int create = -1;
+  int kill   = -1;
 
   //proposal[2]->trial[ic]++;
 
     /* pick birth or death move */
-  if(gsl_rng_uniform(chain->r[ic])<0.5)/* birth move */
+  if(gsl_rng_uniform(r)<0.5)/* birth move */
   {
     //ny=nx+1
     model_y->Nlive++;
     
     //slot new source in at end of live  source array
-    int create = model_y->Nlive-1;
+    create = model_y->Nlive-1;
     
     if(model_y->Nlive<model_x->Nmax)
     {
       //draw new parameters
-      if(freqflag) logQyx = draw_from_fstatistic(data, model_y, model_y->source[create], proposal[2], model_y->source[create]->params, chain->r[ic]);
+      if(freqflag) logQyx = draw_from_fstatistic(data, model_y, model_y->source[create], proposal[PROPOSAL_FSTAT], model_y->source[create]->params, r);
       else
       {
-        draw_from_prior(data, model_y, model_y->source[create], proposal[0], model_y->source[create]->params, chain->r[ic]);
-        if(flags->galaxyPrior) draw_from_galaxy_prior(model_y, prior, model_y->source[create]->params, chain->r[ic]);
+        draw_from_prior(data, model_y, model_y->source[create], proposal[PROPOSAL_DR], model_y->source[create]->params, r);
+        //sky from the galaxy prior's alias table, so logQyx is still the prior
+        if(flags->galaxyPrior) draw_from_galaxy_prior(model_y, prior, model_y->source[create]->params, r);
 
         logQyx = evaluate_prior(flags, data, model_y, prior, model_y->source[create]->params);
       }
@@ -689,7 +525,7 @@ void galactic_binary_rjmcmc(struct Orbit *orbit, struct Data *data, struct Model
     model_y->Nlive--;
     
     //pick source to kill
-    int kill = (int)(gsl_rng_uniform(chain->r[ic])*(double)model_x->Nlive);
+    kill = (int)(gsl_rng_uniform(r)*(double)model_x->Nlive);
     
     if(model_y->Nlive>-1)
     {
@@ -706,7 +542,7 @@ void galactic_binary_rjmcmc(struct Orbit *orbit, struct Data *data, struct Model
         {
           logQxy += model->logPriorVolume[n];
         }
-        logQxy += evaluate_fstatistic_proposal(data, proposal[2], model_y->source[kill]->params);
+        logQxy += (*proposal[PROPOSAL_FSTAT]->density)(data, model_y, model_y->source[kill], proposal[PROPOSAL_FSTAT], model_y->source[kill]->params);
       }
       else         logQxy = evaluate_prior(flags, data, model_y, prior, model_y->source[kill]->params);
       
@@ -766,214 +602,421 @@ void galactic_binary_rjmcmc(struct Orbit *orbit, struct Data *data, struct Model
 //      fclose(fptr);
 //    }
   
-  loga = log(gsl_rng_uniform(chain->r[ic]));
+  loga = log(gsl_rng_uniform(r));
   if(logH > loga)
   {
     //proposal[2]->accept[ic]++;
+    move_histories(model_x, model_y, model_x->Nlive, create, kill);
     copy_model(model_y,model_x);
   }
   
 }
 
-void galactic_binary_drmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic)
+static double drmc_log_target(struct Orbit *orbit, struct Data *data, struct Model *model, struct Chain *chain, struct Flags *flags, struct Prior *prior, int n, int ic)
 {
-  double logH  = 0.0; //(log) Hastings ratio
-  double loga  = 1.0; //(log) transition probability
+  //tempered log posterior of the trial model after source n has changed
+  double logP = evaluate_prior(flags, data, model, prior, model->source[n]->params);
+  if(logP == -INFINITY) return -INFINITY;
   
-  //shorthand pointers
-  struct Data *data_ptr  = data;
+  model->logL = 0.0;
+  if(!flags->prior)
+  {
+    generate_signal_model(orbit, data, model, n);
+    if(flags->calibration)
+    {
+      generate_calibration_model(data, model);
+      apply_calibration_model(data, model);
+    }
+    model->logL = gaussian_log_likelihood(orbit, data, model);
+  }
+  
+  double logL = model->logL/chain->temperature[ic];
+  if(flags->burnin) logL /= chain->annealing;
+  
+  return logL + logP;
+}
+
+static void map_proposed_source(struct Data *data, struct Source *source, struct Flags *flags)
+{
+  map_array_to_params(source, source->params, data->T);
+  
+  //hold sky position fixed to injected value?
+  if(flags->fixSky)
+  {
+    source->costheta = data->inj->costheta;
+    source->phi      = data->inj->phi;
+    map_params_to_array(source, source->params, data->T);
+  }
+}
+
+static void drmc_move(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic, gsl_rng *r)
+{
+  /*
+   Two-stage delayed rejection (Tierney & Mira 1999).  The first stage is a
+   bold independence draw from the F-statistic, the second a local Fisher
+   jump from the current state.  Both stages are built in the chain's own
+   trial model, and the second stage reuses the first stage's cached
+   posterior rather than recomputing it.
+   */
   struct Model *model_x = model;
   struct Model *model_y = trial;
-  struct Model *temp = malloc(sizeof(struct Model) );
-  alloc_model(temp,model_x->Nmax,data_ptr->N,data_ptr->Nchannel, data_ptr->NP, flags->NT);
+  struct Proposal *fstat = proposal[PROPOSAL_FSTAT];
   
   //keep track of DR trials for acceptance rates
-  proposal[0]->trial[ic]++;
+  proposal[PROPOSAL_DR]->trial[ic]++;
+  
+  //pick a source to update
+  int n = (int)(gsl_rng_uniform(r)*(double)model_x->Nlive);
+  
+  struct Source *source_x = model_x->source[n];
+  struct Source *source_y = model_y->source[n];
+  
+  //current state's likelihood is already known
+  double logLx = model_x->logL/chain->temperature[ic];
+  if(flags->burnin) logLx /= chain->annealing;
+  
+  double logPix = logLx + evaluate_prior(flags, data, model_x, prior, source_x->params);
+  double logQx  = evaluate_fstatistic_proposal(data, fstat, source_x->params);
   
-  /* Initialize custom MCMC proposal for DR move */
-  struct Proposal **proposal_temp = malloc((chain->NP+1)*sizeof(struct Proposal*));
-  double check=0.0;
-  for(int i=0; i<=chain->NP; i++)
+  /* first stage: y1 ~ q1(y1), accept with a1(x,y1) */
+  copy_model(model_x,model_y);
+  draw_from_fstatistic(data, model_x, source_y, fstat, source_y->params, r);
+  map_proposed_source(data, source_y, flags);
+  
+  double logPi1 = drmc_log_target(orbit, data, model_y, chain, flags, prior, n, ic);
+  double logQ1  = evaluate_fstatistic_proposal(data, fstat, source_y->params);
+  
+  double loga1 = (logPi1 - logPix) + (logQx - logQ1);
+  if(loga1 > 0.0) loga1 = 0.0;
+  
+  if(loga1 > log(gsl_rng_uniform(r)))
+  {
+    proposal[PROPOSAL_DR]->accept[ic]++;
+    copy_model(model_y,model_x);
+    return;
+  }
+  
+  /* second stage: y2 ~ q2(x,y2) in the same workspace */
+  copy_source(source_x,source_y);
+  draw_from_fisher(data, model_x, source_x, fstat, source_y->params, r);
+  map_proposed_source(data, source_y, flags);
+  
+  double logPi2 = drmc_log_target(orbit, data, model_y, chain, flags, prior, n, ic);
+  if(logPi2 == -INFINITY) return;
+  double logQ2  = evaluate_fstatistic_proposal(data, fstat, source_y->params);
+  
+  //would the first stage have accepted y1 from y2?
+  double loga21 = (logPi1 - logPi2) + (logQ2 - logQ1);
+  if(loga21 > 0.0) loga21 = 0.0;
+  
+  /*
+   q1 only depends on where it lands, so q1(y2->y1)/q1(x->y1) = 1, and the
+   Fisher jump is treated as symmetric (as in galactic_binary_mcmc)
+   */
+  double logH = (logPi2 - logPix) + log1p(-exp(loga21)) - log1p(-exp(loga1));
+  
+  if(logH > log(gsl_rng_uniform(r)))
+  {
+    proposal[PROPOSAL_DR]->accept[ic]++;
+    copy_model(model_y,model_x);
+  }
+}
+
+//delayed rejection move, timed like the proposals in galactic_binary_mcmc()
+void galactic_binary_drmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic, gsl_rng *r)
+{
+  double start = thread_cpu_time();
+  drmc_move(orbit, data, model, trial, chain, flags, prior, proposal, ic, r);
+  proposal[PROPOSAL_DR]->time[ic] += thread_cpu_time() - start;
+}
+
+static double mtm_channel(double *r, double *h, double *Sn, int imin, int BW, int N, double dA, double cal_re, double cal_im, int restore)
+{
+  //<r|h> - <h|h>/2 over the template's bins, with h calibrated (and first added to r if restore)
+  double score = 0.0;
+  for(int i=0; i<BW; i++)
   {
-    proposal_temp[i] = malloc(sizeof(struct Proposal));
-    proposal_temp[i]->trial  = malloc(chain->NC*sizeof(int));
-    proposal_temp[i]->accept = malloc(chain->NC*sizeof(int));
+    int j = i+imin;
+    if(j<0 || j>=N) continue;
     
-    for(int j=0; j<chain->NC; j++)
-    {
-      proposal_temp[i]->trial[j]  = 1;
-      proposal_temp[i]->accept[j] = 0;
-    }
+    double h_re = dA*(h[2*i]*cal_re - h[2*i+1]*cal_im);
+    double h_im = dA*(h[2*i]*cal_im + h[2*i+1]*cal_re);
     
-    switch(i)
+    if(restore)
     {
-      case 1:
-        sprintf(proposal_temp[i]->name,"fisher");
-        proposal_temp[i]->function = &draw_from_fisher;
-        proposal_temp[i]->weight = 0.1;
-        break;
-      case 2:
-        sprintf(proposal_temp[i]->name,"fisher");
-        proposal_temp[i]->function = &draw_from_fisher;
-        proposal_temp[i]->weight = 0.1;
-        break;
-      case 3:
-        sprintf(proposal_temp[i]->name,"fisher");
-        proposal_temp[i]->function = &draw_from_fisher;
-        proposal_temp[i]->weight = 0.1;
-        break;
-      case 4:
-        sprintf(proposal_temp[i]->name,"fisher");
-        proposal_temp[i]->function = &draw_from_fisher;
-        proposal_temp[i]->weight = 0.5;
-        break;
-      case 5:
-        sprintf(proposal_temp[i]->name,"fisher");
-        proposal_temp[i]->function = &draw_from_fisher;
-        proposal_temp[i]->weight = 0.2;
-        break;
-      default:
-        sprintf(proposal_temp[0]->name,"fisher");
-        proposal_temp[0]->function = &draw_from_fisher;
-        proposal_temp[0]->weight = 0.0;
-        break;
+      r[2*j]   += h_re;
+      r[2*j+1] += h_im;
     }
-    check+=proposal_temp[i]->weight;
+    
+    score += (r[2*j]*h_re + r[2*j+1]*h_im - 0.5*(h_re*h_re + h_im*h_im))/Sn[j];
   }
-  if(check<0.99999)
+  
+  //same normalization as fourier_nwip
+  return 4.0*score;
+}
+
+static double mtm_score(struct Data *data, struct Model *model, struct Flags *flags, struct Source *source, struct TDI *residual, int m, int restore)
+{
+  struct Calibration *cal = model->calibration[m];
+  double score = 0.0;
+  
+  switch(data->Nchannel)
   {
-    fprintf(stderr,"Proposal weights not normalized (line %d of file %s)\n",__LINE__,__FILE__);
-    exit(1);
+    case 1:
+      if(flags->calibration) score += mtm_channel(residual->X, source->tdi->X, model->noise[m]->SnX, source->imin, source->BW, data->N, 1.0+cal->dampX, cal->real_dphiX, cal->imag_dphiX, restore);
+      else                   score += mtm_channel(residual->X, source->tdi->X, model->noise[m]->SnX, source->imin, source->BW, data->N, 1.0, 1.0, 0.0, restore);
+      break;
+    case 2:
+      if(flags->calibration)
+      {
+        score += mtm_channel(residual->A, source->tdi->A, model->noise[m]->SnA, source->imin, source->BW, data->N, 1.0+cal->dampA, cal->real_dphiA, cal->imag_dphiA, restore);
+        score += mtm_channel(residual->E, source->tdi->E, model->noise[m]->SnE, source->imin, source->BW, data->N, 1.0+cal->dampE, cal->real_dphiE, cal->imag_dphiE, restore);
+      }
+      else
+      {
+        score += mtm_channel(residual->A, source->tdi->A, model->noise[m]->SnA, source->imin, source->BW, data->N, 1.0, 1.0, 0.0, restore);
+        score += mtm_channel(residual->E, source->tdi->E, model->noise[m]->SnE, source->imin, source->BW, data->N, 1.0, 1.0, 0.0, restore);
+      }
+      break;
+    default:
+      fprintf(stderr,"Unsupported number of channels in mtm_score()\n");
+      exit(1);
   }
   
-  copy_model(model_x,model_y);
-  copy_model(model_x,temp);
+  return score;
+}
+
+static double log_sum_exp(double *x, int N, int skip)
+{
+  double max = -INFINITY;
+  for(int k=0; k<N; k++) if(k!=skip && x[k]>max) max = x[k];
+  if(max == -INFINITY) return -INFINITY;
   
-  //pick a source to update
-  int n = (int)(gsl_rng_uniform(chain->r[ic])*(double)model_x->Nlive);
+  double sum = 0.0;
+  for(int k=0; k<N; k++) if(k!=skip) sum += exp(x[k]-max);
   
-  //more shorthand pointers
-  struct Source *source_x = model_x->source[n];
+  return max + log(sum);
+}
+
+static void mtmc_move(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic, gsl_rng *r)
+{
+  /*
+   Multiple-try Metropolis with independent F-statistic draws (Liu, Liang
+   & Wong 2000).  K candidates are weighted by w = p(y)/q(y) and one is
+   picked in proportion to its weight.  Only source n changes, so with
+   r = d - (model without source n) every candidate's likelihood is
+   logL(x) + [<r|h_y> - <h_y|h_y>/2] - [<r|h_x> - <h_x|h_x>/2],
+   which only needs the template's own bins.
+   */
+  int K = flags->mtm;
+  int NP = data->NP;
   
+  struct Model *model_x = model;
+  struct Model *model_y = trial;
+  struct Proposal *fstat = proposal[PROPOSAL_FSTAT];
   
-  //  // force fm-shift for temp model
-  //    fm_shift(data[0], model_x[0], source_x, temp[0]->source[n]->params, chain->r[ic]);
-  //    double jump = temp[0]->source[n]->params[0] - model_x[0]->source[n]->params[0];
-  //    temp[0]->source[n]->params[0] = model_x[0]->source[n]->params[0] + jump*sqrt(chain->annealing);
-  //    temp[0]->source[n]->params[7] = model_x[0]->source[n]->params[7] - 2*jump*sqrt(chain->annealing);
-  //  }
-  //  else if(gsl_rng_uniform(chain->r[ic])<0.7)
-  //  {
-  //    // force extrinsic update
-  //    draw_from_extrinsic_prior(data[0], model_x[0], source_x, temp[0]->source[n]->params, chain->r[ic]);
-  //  }
+  //keep track of MTM trials for acceptance rates
+  proposal[PROPOSAL_MTM]->trial[ic]++;
   
-  if(gsl_rng_uniform(chain->r[ic])<0.5)
-    draw_from_fstatistic(data, model_x, source_x, proposal[2], temp->source[n]->params, chain->r[ic]);
-  else
-    fm_shift(data, model_x, source_x, proposal[4], temp->source[n]->params, chain->r[ic]);
+  //pick a source to update
+  int n = (int)(gsl_rng_uniform(r)*(double)model_x->Nlive);
   
+  struct Source *source_x = model_x->source[n];
+  struct Source *source_y = model_y->source[n];
   
-  generate_signal_model(orbit, data, temp, n);
-
-  //calibration error
-  if(flags->calibration)
+  copy_model(model_x,model_y);
+  
+  //--mtm sets K, so the candidates go on the heap rather than the thread's stack
+  double (*params)[NP] = malloc(K*sizeof(*params));
+  double *logw  = malloc((K+1)*sizeof(double));
+  double *dlogL = malloc(K*sizeof(double));
+  
+  //draw the candidates (the last entry of logw is for the current state)
+  for(int k=0; k<K; k++)
   {
-    draw_calibration_parameters(data, temp, chain->r[ic]);
-    generate_calibration_model(data, temp);
-    apply_calibration_model(data, temp);
+    draw_from_fstatistic(data, model_x, source_y, fstat, source_y->params, r);
+    map_proposed_source(data, source_y, flags);
+    for(int j=0; j<NP; j++) params[k][j] = source_y->params[j];
+    
+    logw[k]  = evaluate_prior(flags, data, model_y, prior, params[k]);
+    logw[k] -= evaluate_fstatistic_proposal(data, fstat, params[k]);
+    dlogL[k] = 0.0;
   }
+  logw[K]  = evaluate_prior(flags, data, model_x, prior, source_x->params);
+  logw[K] -= evaluate_fstatistic_proposal(data, fstat, source_x->params);
   
-  temp->logL = gaussian_log_likelihood(orbit, data, temp);
-
-  //if(ic==0)printf("delayed rejection hastings ratio: %g: ",temp->logL);
+  //score every candidate against the shared residual, one segment at a time
+  if(!flags->prior)
+  {
+    for(int m=0; m<model_y->NT; m++)
+    {
+      struct TDI *residual = model_y->residual[m];
+      for(int i=0; i<2*data->N; i++)
+      {
+        residual->X[i] = data->tdi[m]->X[i] - model_x->tdi[m]->X[i];
+        residual->A[i] = data->tdi[m]->A[i] - model_x->tdi[m]->A[i];
+        residual->E[i] = data->tdi[m]->E[i] - model_x->tdi[m]->E[i];
+      }
+      
+      //put source n back into the residual
+      copy_source(source_x,source_y);
+      galactic_binary(orbit, data->format, data->T, model_y->t0[m], source_y->params, NP, source_y->tdi->X, source_y->tdi->A, source_y->tdi->E, source_y->BW, source_y->tdi->Nchannel);
+      double score_x = mtm_score(data, model_y, flags, source_y, residual, m, 1);
+      
+      for(int k=0; k<K; k++)
+      {
+        if(logw[k] == -INFINITY) continue;
+        
+        for(int j=0; j<NP; j++) source_y->params[j] = params[k][j];
+        galactic_binary_alignment(orbit, data, source_y);
+        galactic_binary(orbit, data->format, data->T, model_y->t0[m], source_y->params, NP, source_y->tdi->X, source_y->tdi->A, source_y->tdi->E, source_y->BW, source_y->tdi->Nchannel);
+        dlogL[k] += mtm_score(data, model_y, flags, source_y, residual, m, 0) - score_x;
+      }
+    }
+  }
   
+  //tempered likelihood enters the weights
+  for(int k=0; k<K; k++)
+  {
+    double logL = (model_x->logL + dlogL[k])/chain->temperature[ic];
+    if(flags->burnin) logL /= chain->annealing;
+    logw[k] += logL;
+  }
+  double logLx = model_x->logL/chain->temperature[ic];
+  if(flags->burnin) logLx /= chain->annealing;
+  logw[K] += logLx;
   
-  // do a bunch of MCMC steps to evolve from forced jump
-  for(int i=0; i<100; i++)galactic_binary_mcmc(orbit, data, temp, model_y, chain, flags, prior, proposal_temp, ic);
+  double logW = log_sum_exp(logw, K, -1);
+  if(logW == -INFINITY)
+  {
+    free(params);
+    free(logw);
+    free(dlogL);
+    return;
+  }
   
-  // test current likelihood for model y to original likelihood of model x
-  logH += (model_y->logL - model_x->logL)/chain->temperature[ic];
-  //if(ic==0)printf("%g = %g - %g\n",logH,model_y[0]->logL,model_x[0]->logL);
-  if(flags->burnin) logH /= chain->annealing;
-  loga = log(gsl_rng_uniform(chain->r[ic]));
-  if(logH > loga)
+  //select a candidate in proportion to its weight
+  int select = K-1;
+  double u = gsl_rng_uniform(r);
+  double cdf = 0.0;
+  for(int k=0; k<K; k++)
   {
-    proposal[chain->NP]->accept[ic]++;
-    copy_model(model_y,model_x);
+    cdf += exp(logw[k]-logW);
+    if(u < cdf)
+    {
+      select = k;
+      break;
+    }
   }
   
-  free_model(temp);
+  //swap the selected candidate for the current state in the reference set
+  double logH = logW - log_sum_exp(logw, K+1, select);
   
-  for(int i=0; i<=chain->NP; i++)
+  if(logH > log(gsl_rng_uniform(r)))
   {
-    free(proposal_temp[i]->trial);
-    free(proposal_temp[i]->accept);
-    free(proposal_temp[i]);
+    proposal[PROPOSAL_MTM]->accept[ic]++;
+    
+    copy_source(source_x,source_y);
+    for(int j=0; j<NP; j++) source_y->params[j] = params[select][j];
+    
+    if(!flags->prior)
+    {
+      generate_signal_model(orbit, data, model_y, n);
+      if(flags->calibration)
+      {
+        generate_calibration_model(data, model_y);
+        apply_calibration_model(data, model_y);
+      }
+      model_y->logL = gaussian_log_likelihood(orbit, data, model_y);
+    }
+    else map_array_to_params(source_y, source_y->params, data->T);
+    
+    copy_model(model_y,model_x);
   }
-  free(proposal_temp);
   
+  free(params);
+  free(logw);
+  free(dlogL);
 }
 
-void data_mcmc(struct Orbit *orbit, struct Data **data, struct Model **model, struct Chain *chain, struct Flags *flags, struct Proposal **proposal, int ic)
+//multiple-try move, timed like the proposals in galactic_binary_mcmc()
+void galactic_binary_mtmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic, gsl_rng *r)
+{
+  double start = thread_cpu_time();
+  mtmc_move(orbit, data, model, trial, chain, flags, prior, proposal, ic, r);
+  proposal[PROPOSAL_MTM]->time[ic] += thread_cpu_time() - start;
+}
+
+void data_mcmc(struct Orbit *orbit, struct Data **data, struct Model **model, struct Model **trial, struct Chain *chain, struct Flags *flags, struct Proposal **proposal, int ic)
 {
   double logH  = 0.0; //(log) Hastings ratio
   double loga  = 1.0; //(log) transition probability
   double logQ  = 0.0;
   
-  struct Model **trial = malloc(sizeof(struct Model *) * flags->NDATA);
+  int NT = flags->NT;
   
-  for(int i=0; i<flags->NDATA; i++)
-  {
-    trial[i] = malloc(sizeof(struct Model));
-    
-    
-    alloc_model(trial[i],model[i]->Nmax,data[i]->N,data[i]->Nchannel, data[i]->NP, flags->NT);
-    
-    set_uniform_prior(flags, trial[i], data[i], 0);
-    
-    copy_model(model[i],trial[i]);
-  }
+  /*
+   Only the segment start times move.  A segment's waveform is rebuilt only
+   if its own t0 changed, and the likelihood can only change in the bins
+   covered by sources.  trial[] is the chain's persistent scratch model.
+   */
+  for(int j=0; j<flags->NDATA; j++) copy_model(model[j],trial[j]);
   
   logQ += t0_shift(data[0], trial[0], trial[0]->source[0], proposal[0], trial[0]->source[0]->params, chain->r[ic]);
+  if(logQ == -INFINITY) return;
   
   for(int j=1; j<flags->NDATA; j++)
   {
-    for(int i=0; i<flags->NT; i++)
+    for(int i=0; i<NT; i++)
     {
       trial[j]->t0[i] = trial[0]->t0[i];
-//      for(int n=0; n<trial[0]->Nlive; n++)
-//      {
-//        double dt = trial[j]->t0[i] - model[j]->t0[i];
-//        trial[0]->source[n]->params[0] += -(1.e-7/5.)*dt;
-//      }
     }
   }
   
   for(int j=0; j<flags->NDATA; j++)
   {
-    // Form master template
-    /*
-     passing generate_signal_model -1 results in full recalculation of waveform model
-     */
-    generate_signal_model(orbit, data[j], trial[j], -1);
-    //generate_signal_model(orbit, data[j], model[j], -1);
-
+    struct Model *model_x = model[j];
+    struct Model *model_y = trial[j];
+    
+    //frequency bins touched by any source
+    int imin = data[j]->N;
+    int imax = 0;
+    for(int n=0; n<model_y->Nlive; n++)
+    {
+      struct Source *source = model_y->source[n];
+      if(source->imin < imin) imin = source->imin;
+      if(source->imin + source->BW > imax) imax = source->imin + source->BW;
+    }
+    if(imin < 0) imin = 0;
+    if(imax > data[j]->N) imax = data[j]->N;
+    
+    double dlogL = 0.0;
+    int last = -1;
+    for(int m=0; m<NT; m++)
+    {
+      if(model_y->t0[m] == model_x->t0[m]) continue;
+      
+      generate_signal_segment(orbit, data[j], model_y, m);
+      if(flags->calibration) apply_calibration_segment(data[j], model_y, m);
+      
+      if(!flags->prior && imax > imin)
+        dlogL += gaussian_log_likelihood_band(data[j], model_y, m, imin, imax) - gaussian_log_likelihood_band(data[j], model_x, m, imin, imax);
+      
+      last = m;
+    }
+    
+    //source waveforms are left holding the final segment (as in generate_signal_model)
+    if(last > -1 && last < NT-1)
+      for(int n=0; n<model_y->Nlive; n++) copy_tdi(model_x->source[n]->tdi, model_y->source[n]->tdi);
+    
     /*
      H = [p(d|y)/p(d|x)]/T x p(y)/p(x) x q(x|y)/q(y|x)
      */
-    if(!flags->prior)
-    {
-      // get likelihood for y
-      trial[j]->logL = gaussian_log_likelihood(orbit, data[j], trial[j]);
-      //model[j]->logL = gaussian_log_likelihood(orbit, data[j], model[j]);
-
-      logH += (trial[j]->logL - model[j]->logL)/chain->temperature[ic];
-      if(flags->burnin) logH /= chain->annealing;
-    }
-    logH += logQ; //delta logL
-
+    model_y->logL = model_x->logL + dlogL;
+    logH += dlogL/chain->temperature[ic];
   }
+  if(flags->burnin) logH /= chain->annealing;
+  logH += logQ;
   
   loga = log(gsl_rng_uniform(chain->r[ic]));
   
@@ -984,15 +1027,270 @@ void data_mcmc(struct Orbit *orbit, struct Data **data, struct Model **model, st
       copy_model(trial[j],model[j]);
     }
   }
+}
+
+static void update_proposal_weights(struct Proposal **proposal, struct Chain *chain, struct Flags *flags)
+{
+  int NP = chain->NP;
+  double accept[NP+1];
+  double time[NP+1];
   
-  for(int i=0; i<flags->NDATA; i++)
+  for(int n=0; n<NP+1; n++)
   {
-    free_model(trial[i]);
+    accept[n] = 0.0;
+    time[n]   = 0.0;
+    for(int ic=0; ic<chain->NC; ic++)
+    {
+      accept[n] += (double)proposal[n]->accept[ic];
+      time[n]   += proposal[n]->time[ic];
+    }
   }
-  free(trial);
   
+#ifdef USE_MPI
+  //each rank only counts moves made by the chains it held, so every rank needs the totals to agree on the weights
+  MPI_Allreduce(MPI_IN_PLACE, accept, NP+1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, time,   NP+1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+  
+  adapt_proposal_weights(proposal, NP, accept, time, flags);
 }
 
+int mcmc_iteration(struct Orbit *orbit, struct Data **data, struct Model ***model, struct Model ***trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal ***proposal, int mcmc, int cycle, int rank, int size)
+{
+  int NC = chain->NC;
+  
+  if(mcmc<0) flags->burnin=1;
+  else       flags->burnin=0;
+  
+  chain->annealing=1.0;
+  
+  /*
+   Source and noise updates only touch model[chain][segment], so every
+   (chain, segment) pair is an independent task with its own random stream.
+   The cross-segment moves (data_mcmc, ptmcmc) wait for all tasks to finish.
+   */
+  #pragma omp parallel for collapse(2) schedule(dynamic) num_threads(flags->threads)
+  for(int ic=0; ic<NC; ic++)
+  {
+    //loop over frequency segments
+    for(int i=0; i<flags->NDATA; i++)
+    {
+      //skip chains held by other ranks
+      if(chain->index[ic]%size != rank) continue;
+      
+      struct Model *model_ptr = model[chain->index[ic]][i];
+      struct Model *trial_ptr = trial[chain->index[ic]][i];
+      struct Data  *data_ptr  = data[i];
+      
+      //random stream for this chain, segment, and iteration
+      gsl_rng *r = alloc_rng_stream(chain->seed, ic, i, cycle, RNG_SAMPLER);
+      
+      int Nsteps = temperature_steps(chain, flags, ic);
+      for(int steps=0; steps < Nsteps; steps++)
+      {
+        galactic_binary_mcmc(orbit, data_ptr, model_ptr, trial_ptr, chain, flags, prior, proposal[i], ic, r);
+        
+        noise_model_mcmc(orbit, data_ptr, model_ptr, trial_ptr, chain, flags, ic, r);
+      }//loop over MCMC steps
+      
+      //thinned history for differential evolution
+      update_history(model_ptr);
+      
+      //reverse jump birth/death move
+      if(flags->rj)galactic_binary_rjmcmc(orbit, data_ptr, model_ptr, trial_ptr, chain, flags, prior, proposal[i], ic, r);
+      
+      //delayed rejection mode-hopper
+      if(flags->dr && model_ptr->Nlive>0)galactic_binary_drmc(orbit, data_ptr, model_ptr, trial_ptr, chain, flags, prior, proposal[i], ic, r);
+      
+      //multiple-try F-statistic move
+      if(flags->mtm && model_ptr->Nlive>0)galactic_binary_mtmc(orbit, data_ptr, model_ptr, trial_ptr, chain, flags, prior, proposal[i], ic, r);
+      
+      //update fisher matrix for each chain
+      update_fisher(orbit, data_ptr, model_ptr, chain, flags, ic, mcmc);
+      
+      gsl_rng_free(r);
+    }//end loop over frequency segments
+  }// end (parallel) loop over chains and segments
+  
+  //update start time for data segments
+  if(flags->gap)
+  {
+    #pragma omp parallel for schedule(dynamic) num_threads(flags->threads)
+    for(int ic=0; ic<NC; ic++)
+    {
+      if(chain->index[ic]%size != rank) continue;
+      set_rng_stream(chain->r[ic], chain->seed, ic, 0, cycle, RNG_DATA);
+      data_mcmc(orbit, data, model[chain->index[ic]], trial[chain->index[ic]], chain, flags, proposal[0], ic);
+    }
+  }
+  
+#ifdef USE_MPI
+  mpi_ptmcmc(data, model, chain, flags, cycle, rank, size);
+#else
+  ptmcmc(model,chain,flags,cycle);
+#endif
+  if(!flags->tuneLadder) adapt_temperature_ladder(chain, mcmc+flags->NBURN);
+  else if(flags->burnin) tune_temperature_ladder(chain);
+  
+  //re-weight proposals by accepted moves per CPU second (burn-in only)
+  if(flags->adaptWeights>0.0 && flags->burnin && mcmc%100==0)
+    for(int i=0; i<flags->NDATA; i++) update_proposal_weights(proposal[i], chain, flags);
+  
+  //chain files are written by the rank holding the cold chain
+  if(chain->index[0]%size == rank) print_chain_files(data[FIXME], model, chain, flags, mcmc);
+  
+  //track maximum log Likelihood
+  if(mcmc%100)
+  {
+#ifdef USE_MPI
+    if(mpi_update_max_log_likelihood(orbit, data, model, chain, flags, rank, size)) mcmc = -flags->NBURN;
+#else
+    if(update_max_log_likelihood(model, chain, flags)) mcmc = -flags->NBURN;
+#endif
+  }
+  
+  return mcmc;
+}
 
+#ifdef USE_MPI
+void mpi_ptmcmc(struct Data **data, struct Model ***model, struct Chain *chain, struct Flags *flags, int mcmc, int rank, int size)
+{
+  /*
+   Only the likelihoods are exchanged, the models stay where they are.
+   Swaps are proposed on the root rank and the new temperature
+   assignments (chain->index) are broadcast to the other ranks.
+   */
+  mpi_share_chain_state(data, model, chain, flags, rank, size);
+  
+  if(rank==0) ptmcmc(model,chain,flags,mcmc);
+  
+  MPI_Bcast(chain->index, chain->NC, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(chain->acceptance, chain->NC, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  
+  //swap statistics drive --tune-ladder, which every rank runs
+  MPI_Bcast(chain->direction,  chain->NC, MPI_INT,    0, MPI_COMM_WORLD);
+  MPI_Bcast(chain->roundTrips, chain->NC, MPI_INT,    0, MPI_COMM_WORLD);
+  MPI_Bcast(chain->swapTrial,  chain->NC, MPI_INT,    0, MPI_COMM_WORLD);
+  MPI_Bcast(chain->swapReject, chain->NC, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+}
 
+void mpi_share_chain_state(struct Data **data, struct Model ***model, struct Chain *chain, struct Flags *flags, int rank, int size)
+{
+  int NC = chain->NC;
+  int N  = flags->NDATA;
+  
+  //full parameter state is only needed for the hot chain files
+  int M = 3;
+  if(flags->verbose) M = model_state_size(model[0][0]);
+  
+  double *state = calloc(NC*N*M, sizeof(double));
+  double *share = malloc(NC*N*M*sizeof(double));
+  
+  for(int m=0; m<NC; m++)
+  {
+    if(m%size != rank) continue;
+    
+    for(int i=0; i<N; i++)
+    {
+      double *s = state + (m*N+i)*M;
+      if(flags->verbose) pack_model_state(model[m][i], s);
+      else
+      {
+        s[0] = (double)model[m][i]->Nlive;
+        s[1] = model[m][i]->logL;
+        s[2] = model[m][i]->logLnorm;
+      }
+    }
+  }
+  
+  //each slot is only filled by its owner, so the sum is a gather
+  MPI_Allreduce(state, share, NC*N*M, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  
+  for(int m=0; m<NC; m++)
+  {
+    if(m%size == rank) continue;
+    
+    for(int i=0; i<N; i++)
+    {
+      double *s = share + (m*N+i)*M;
+      if(flags->verbose) unpack_model_state(model[m][i], s, data[i]->T);
+      else
+      {
+        model[m][i]->Nlive    = (int)s[0];
+        model[m][i]->logL     = s[1];
+        model[m][i]->logLnorm = s[2];
+      }
+    }
+  }
+  
+  free(state);
+  free(share);
+}
 
+int mpi_update_max_log_likelihood(struct Orbit *orbit, struct Data **data, struct Model ***model, struct Chain *chain, struct Flags *flags, int rank, int size)
+{
+  int n = chain->index[0];
+  int N = flags->NDATA;
+  int owner = n%size;
+  
+  double logL = 0.0;
+  double dlogL= 0.0;
+  
+  // get full likelihood (identical on all ranks after mpi_ptmcmc)
+  for(int i=0; i<flags->NDATA; i++) logL += model[n][i]->logL + model[n][i]->logLnorm;
+  
+  // update max
+  if(logL > chain->logLmax)
+  {
+    dlogL = logL - chain->logLmax;
+    
+    //clone chains if new mode is found (dlogL > D/2)
+    if( dlogL > (double)(8*N/2) )
+    {
+      chain->logLmax = logL;
+      
+      for(int i=0; i<N; i++)
+      {
+        //send the cold chain's parameters and Fisher matrices to the other ranks
+        int M = model_state_size(model[n][i]);
+        int F = fisher_state_size(model[n][i]);
+        double *state  = malloc(M*sizeof(double));
+        double *fisher = malloc(F*sizeof(double));
+        if(rank==owner)
+        {
+          pack_model_state(model[n][i], state);
+          pack_fisher_state(model[n][i], fisher);
+        }
+        MPI_Bcast(state,  M, MPI_DOUBLE, owner, MPI_COMM_WORLD);
+        MPI_Bcast(fisher, F, MPI_DOUBLE, owner, MPI_COMM_WORLD);
+        
+        for(int ic=1; ic<chain->NC; ic++)
+        {
+          int m = chain->index[ic];
+          if(m%size != rank) continue;
+          
+          if(rank==owner) copy_model(model[n][i],model[m][i]);
+          else
+          {
+            //rebuild the cloned model from its parameters
+            unpack_model_state(model[m][i], state, data[i]->T);
+            generate_noise_model(data[i], model[m][i]);
+            generate_signal_model(orbit, data[i], model[m][i], -1);
+            if(flags->calibration)
+            {
+              generate_calibration_model(data[i], model[m][i]);
+              apply_calibration_model(data[i], model[m][i]);
+            }
+            unpack_fisher_state(model[m][i], fisher);
+          }
+        }
+        free(state);
+        free(fisher);
+      }
+      if(flags->burnin)return 1;
+    }
+  }
+  
+  return 0;
+}
+#endif
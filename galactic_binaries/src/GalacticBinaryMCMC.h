@@ -0,0 +1,40 @@
+//
+//  GalacticBinaryMCMC.h
+//
+//
+//  Created by Littenberg, Tyson B. (MSFC-ZP12) on 1/15/17.
+//
+//
+
+#ifndef GalacticBinaryMCMC_h
+#define GalacticBinaryMCMC_h
+
+#include <gsl/gsl_rng.h>
+
+void ptmcmc(struct Model ***model, struct Chain *chain, struct Flags *flags, int mcmc);
+void adapt_temperature_ladder(struct Chain *chain, int mcmc);
+void tune_temperature_ladder(struct Chain *chain);
+
+void galactic_binary_mcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic, gsl_rng *r);
+void galactic_binary_drmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic, gsl_rng *r);
+void galactic_binary_mtmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic, gsl_rng *r);
+void galactic_binary_rjmcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal **proposal, int ic, gsl_rng *r);
+
+void data_mcmc(struct Orbit *orbit, struct Data **data, struct Model **model, struct Model **trial, struct Chain *chain, struct Flags *flags, struct Proposal **proposal, int ic);
+void update_fisher(struct Orbit *orbit, struct Data *data, struct Model *model, struct Chain *chain, struct Flags *flags, int ic, int mcmc);
+
+void noise_model_mcmc(struct Orbit *orbit, struct Data *data, struct Model *model, struct Model *trial, struct Chain *chain, struct Flags *flags, int ic, gsl_rng *r);
+
+/* one sampler iteration over all chains and segments, returns mcmc (reset to -NBURN if burn-in restarts) */
+int mcmc_iteration(struct Orbit *orbit, struct Data **data, struct Model ***model, struct Model ***trial, struct Chain *chain, struct Flags *flags, struct Prior *prior, struct Proposal ***proposal, int mcmc, int cycle, int rank, int size);
+
+//wall clock seconds
+double wall_time(void);
+
+#ifdef USE_MPI
+void mpi_ptmcmc(struct Data **data, struct Model ***model, struct Chain *chain, struct Flags *flags, int mcmc, int rank, int size);
+void mpi_share_chain_state(struct Data **data, struct Model ***model, struct Chain *chain, struct Flags *flags, int rank, int size);
+int  mpi_update_max_log_likelihood(struct Orbit *orbit, struct Data **data, struct Model ***model, struct Chain *chain, struct Flags *flags, int rank, int size);
+#endif
+
+#endif /* GalacticBinaryMCMC_h */
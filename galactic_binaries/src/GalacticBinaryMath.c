@@ -13,6 +13,7 @@
 #include <gsl/gsl_vector.h>
 #include <gsl/gsl_eigen.h>
 #include <gsl/gsl_sf.h>
+#include <gsl/gsl_randist.h>
 
 #include "LISA.h"
 #include "GalacticBinary.h"
@@ -310,3 +311,351 @@ double power_spectrum(double *data, int n)
   
   return (Re*Re + Im*Im);
 }
+
+/* ********************************************************************************** */
+/*																					                                          */
+/*                                   Sampling Tools                                   */
+/*																					                                          */
+/* ********************************************************************************** */
+
+struct Alias *setup_alias_table(double *weight, int N)
+{
+  struct Alias *table = malloc(sizeof(struct Alias));
+  table->N     = N;
+  table->prob  = malloc(N*sizeof(double));
+  table->alias = malloc(N*sizeof(int));
+  
+  double sum = 0.0;
+  for(int i=0; i<N; i++) if(weight[i]>0.0) sum += weight[i];
+  if(!(sum>0.0))
+  {
+    fprintf(stderr,"setup_alias_table: weights sum to %g\n",sum);
+    exit(1);
+  }
+  
+  //sort cells by whether they hold more or less than an even share
+  int *small = malloc(N*sizeof(int));
+  int *large = malloc(N*sizeof(int));
+  int Nsmall = 0;
+  int Nlarge = 0;
+  for(int i=0; i<N; i++)
+  {
+    table->prob[i]  = (weight[i]>0.0) ? weight[i]*(double)N/sum : 0.0;
+    table->alias[i] = i;
+    if(table->prob[i]<1.0) small[Nsmall++] = i;
+    else                   large[Nlarge++] = i;
+  }
+  
+  //top up each small cell from a large one
+  while(Nsmall>0 && Nlarge>0)
+  {
+    int s = small[--Nsmall];
+    int l = large[--Nlarge];
+    
+    table->alias[s] = l;
+    table->prob[l] -= 1.0 - table->prob[s];
+    
+    if(table->prob[l]<1.0) small[Nsmall++] = l;
+    else                   large[Nlarge++] = l;
+  }
+  
+  //whatever is left over is full up to round-off
+  while(Nlarge>0) table->prob[large[--Nlarge]] = 1.0;
+  while(Nsmall>0) table->prob[small[--Nsmall]] = 1.0;
+  
+  free(small);
+  free(large);
+  
+  return table;
+}
+
+int draw_from_alias_table(struct Alias *table, gsl_rng *seed)
+{
+  int i = (int)(gsl_rng_uniform(seed)*table->N);
+  if(gsl_rng_uniform(seed) < table->prob[i]) return i;
+  return table->alias[i];
+}
+
+void free_alias_table(struct Alias *table)
+{
+  free(table->prob);
+  free(table->alias);
+  free(table);
+}
+
+struct GMM *alloc_gmm(int NP, int K)
+{
+  struct GMM *gmm = malloc(sizeof(struct GMM));
+  gmm->NP   = NP;
+  gmm->K    = K;
+  gmm->w    = malloc(K*sizeof(double));
+  gmm->logN = malloc(K*sizeof(double));
+  gmm->mu   = malloc(K*sizeof(double *));
+  gmm->L    = malloc(K*sizeof(double **));
+  for(int k=0; k<K; k++)
+  {
+    gmm->mu[k] = malloc(NP*sizeof(double));
+    gmm->L[k]  = malloc(NP*sizeof(double *));
+    for(int i=0; i<NP; i++) gmm->L[k][i] = calloc(NP,sizeof(double));
+  }
+  return gmm;
+}
+
+void free_gmm(struct GMM *gmm)
+{
+  for(int k=0; k<gmm->K; k++)
+  {
+    for(int i=0; i<gmm->NP; i++) free(gmm->L[k][i]);
+    free(gmm->L[k]);
+    free(gmm->mu[k]);
+  }
+  free(gmm->L);
+  free(gmm->mu);
+  free(gmm->logN);
+  free(gmm->w);
+  free(gmm);
+}
+
+//lower-triangular L with L*L^T = C, returns 1 if C is not positive definite
+static int cholesky(double **C, double **L, int N)
+{
+  for(int i=0; i<N; i++)
+  {
+    for(int j=0; j<=i; j++)
+    {
+      double sum = C[i][j];
+      for(int k=0; k<j; k++) sum -= L[i][k]*L[j][k];
+      if(i==j)
+      {
+        if(!(sum>0.0)) return 1;
+        L[i][i] = sqrt(sum);
+      }
+      else L[i][j] = sum/L[j][j];
+    }
+    for(int j=i+1; j<N; j++) L[i][j] = 0.0;
+  }
+  return 0;
+}
+
+//log of w_k N(x|mu_k,C_k)
+static double gmm_component_density(struct GMM *gmm, int k, double *x)
+{
+  int NP = gmm->NP;
+  double **L = gmm->L[k];
+  double y[NP];
+  double chi2 = 0.0;
+  
+  //solve L y = x - mu
+  for(int i=0; i<NP; i++)
+  {
+    double sum = x[i] - gmm->mu[k][i];
+    for(int j=0; j<i; j++) sum -= L[i][j]*y[j];
+    y[i] = sum/L[i][i];
+    chi2 += y[i]*y[i];
+  }
+  
+  return gmm->logN[k] - 0.5*chi2;
+}
+
+void normalize_gmm(struct GMM *gmm)
+{
+  for(int k=0; k<gmm->K; k++)
+  {
+    if(!(gmm->w[k]>0.0)) continue;
+    gmm->logN[k] = log(gmm->w[k]) - 0.5*(double)gmm->NP*log(2.0*M_PI);
+    for(int i=0; i<gmm->NP; i++) gmm->logN[k] -= log(gmm->L[k][i][i]);
+  }
+}
+
+double gmm_density(struct GMM *gmm, double *x)
+{
+  double logp[gmm->K];
+  double max = -INFINITY;
+  for(int k=0; k<gmm->K; k++)
+  {
+    logp[k] = gmm_component_density(gmm, k, x);
+    if(logp[k]>max) max = logp[k];
+  }
+  
+  double sum = 0.0;
+  for(int k=0; k<gmm->K; k++) sum += exp(logp[k]-max);
+  
+  return max + log(sum);
+}
+
+void draw_from_gmm(struct GMM *gmm, double *x, gsl_rng *seed)
+{
+  //pick a component
+  int k = 0;
+  double u = gsl_rng_uniform(seed);
+  while(k<gmm->K-1 && (u -= gmm->w[k]) > 0.0) k++;
+  
+  //x = mu + L z
+  int NP = gmm->NP;
+  double z[NP];
+  for(int i=0; i<NP; i++) z[i] = gsl_ran_gaussian(seed,1.0);
+  for(int i=0; i<NP; i++)
+  {
+    x[i] = gmm->mu[k][i];
+    for(int j=0; j<=i; j++) x[i] += gmm->L[k][i][j]*z[j];
+  }
+}
+
+/*
+ Expectation-maximization fit of a K component mixture to samples[n][i]
+ -components start at evenly spaced samples with the covariance of them all
+ -covariances get 1e-6 of the sample variance added to the diagonal
+  so that tightly constrained (or fixed) parameters stay invertible
+ -components left with too few samples to fix a covariance are dropped
+ */
+struct GMM *fit_gmm(double **samples, int N, int NP, int K)
+{
+  if(K>N/(NP+1)) K = N/(NP+1);
+  if(K<1)
+  {
+    fprintf(stderr,"fit_gmm: %i samples are too few for a %i dimensional mixture\n",N,NP);
+    exit(1);
+  }
+  
+  struct GMM *gmm = alloc_gmm(NP,K);
+  
+  //sample covariance
+  double mean[NP];
+  double **C = malloc(NP*sizeof(double *));
+  for(int i=0; i<NP; i++) C[i] = calloc(NP,sizeof(double));
+  for(int i=0; i<NP; i++)
+  {
+    mean[i] = 0.0;
+    for(int n=0; n<N; n++) mean[i] += samples[n][i];
+    mean[i] /= (double)N;
+  }
+  for(int n=0; n<N; n++)
+    for(int i=0; i<NP; i++)
+      for(int j=0; j<=i; j++)
+        C[i][j] += (samples[n][i]-mean[i])*(samples[n][j]-mean[j])/(double)N;
+  
+  double reg[NP];
+  for(int i=0; i<NP; i++)
+  {
+    reg[i] = 1.0e-6*C[i][i];
+    if(!(reg[i]>0.0)) reg[i] = 1.0e-12*(1.0 + mean[i]*mean[i]);
+    C[i][i] += reg[i];
+    for(int j=0; j<i; j++) C[j][i] = C[i][j];
+  }
+  
+  for(int k=0; k<K; k++)
+  {
+    int n = (int)(((double)k + 0.5)*(double)N/(double)K);
+    for(int i=0; i<NP; i++) gmm->mu[k][i] = samples[n][i];
+    gmm->w[k] = 1.0/(double)K;
+    if(cholesky(C, gmm->L[k], NP))
+    {
+      fprintf(stderr,"fit_gmm: sample covariance is not positive definite\n");
+      exit(1);
+    }
+  }
+  normalize_gmm(gmm);
+  
+  //responsibility of each component for each sample
+  double **r = malloc(N*sizeof(double *));
+  for(int n=0; n<N; n++) r[n] = malloc(K*sizeof(double));
+  
+  double logLold = -INFINITY;
+  for(int iter=0; iter<200; iter++)
+  {
+    //E-step
+    double logL = 0.0;
+    for(int n=0; n<N; n++)
+    {
+      double max = -INFINITY;
+      for(int k=0; k<K; k++)
+      {
+        r[n][k] = (gmm->w[k]>0.0) ? gmm_component_density(gmm, k, samples[n]) : -INFINITY;
+        if(r[n][k]>max) max = r[n][k];
+      }
+      double sum = 0.0;
+      for(int k=0; k<K; k++) sum += (r[n][k] = exp(r[n][k]-max));
+      for(int k=0; k<K; k++) r[n][k] /= sum;
+      logL += max + log(sum);
+    }
+    
+    if(logL - logLold < 1.0e-6*(double)N) break;
+    logLold = logL;
+    
+    //M-step
+    for(int k=0; k<K; k++)
+    {
+      if(!(gmm->w[k]>0.0)) continue;
+      
+      double Nk = 0.0;
+      for(int n=0; n<N; n++) Nk += r[n][k];
+      
+      if(Nk < (double)(NP+1))
+      {
+        gmm->w[k] = 0.0;
+        continue;
+      }
+      
+      for(int i=0; i<NP; i++)
+      {
+        gmm->mu[k][i] = 0.0;
+        for(int n=0; n<N; n++) gmm->mu[k][i] += r[n][k]*samples[n][i];
+        gmm->mu[k][i] /= Nk;
+      }
+      
+      for(int i=0; i<NP; i++) for(int j=0; j<=i; j++) C[i][j] = 0.0;
+      for(int n=0; n<N; n++)
+      {
+        if(r[n][k]<1.0e-12) continue;
+        for(int i=0; i<NP; i++)
+          for(int j=0; j<=i; j++)
+            C[i][j] += r[n][k]*(samples[n][i]-gmm->mu[k][i])*(samples[n][j]-gmm->mu[k][j]);
+      }
+      for(int i=0; i<NP; i++)
+      {
+        for(int j=0; j<=i; j++) C[j][i] = C[i][j] = C[i][j]/Nk;
+        C[i][i] += reg[i];
+      }
+      
+      gmm->w[k] = Nk/(double)N;
+      if(cholesky(C, gmm->L[k], NP)) gmm->w[k] = 0.0;
+    }
+    
+    //renormalize surviving weights
+    double W = 0.0;
+    for(int k=0; k<K; k++) W += gmm->w[k];
+    for(int k=0; k<K; k++) gmm->w[k] /= W;
+    normalize_gmm(gmm);
+  }
+  
+  for(int n=0; n<N; n++) free(r[n]);
+  free(r);
+  for(int i=0; i<NP; i++) free(C[i]);
+  free(C);
+  
+  //pack surviving components to the front
+  int M = 0;
+  for(int k=0; k<K; k++)
+  {
+    if(!(gmm->w[k]>0.0)) continue;
+    if(M<k)
+    {
+      double *mu = gmm->mu[M]; gmm->mu[M] = gmm->mu[k]; gmm->mu[k] = mu;
+      double **L = gmm->L[M];  gmm->L[M]  = gmm->L[k];  gmm->L[k]  = L;
+      gmm->w[M]    = gmm->w[k];
+      gmm->logN[M] = gmm->logN[k];
+    }
+    M++;
+  }
+  
+  //free the dropped components' storage and shrink to the survivors
+  for(int k=M; k<K; k++)
+  {
+    for(int i=0; i<NP; i++) free(gmm->L[k][i]);
+    free(gmm->L[k]);
+    free(gmm->mu[k]);
+  }
+  gmm->K = M;
+  
+  return gmm;
+}
@@ -12,8 +12,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-double swap, tempr;
-#define SWAP(a,b) {swap=(a);(a)=(b);(b)=swap;}
+#include <gsl/gsl_rng.h>
+
+#define SWAP(a,b) {double swap=(a);(a)=(b);(b)=swap;}
 
 double chirpmass(double m1, double m2);
 
@@ -36,4 +37,45 @@ void drealft(double data[], unsigned long n, int isign);
 
 double power_spectrum(double *data, int n);
 
+/* ********************************************************************************** */
+/*																					  */
+/*                                   Sampling Tools                                   */
+/*																					  */
+/* ********************************************************************************** */
+
+/*
+ Walker/Vose alias table for O(1) draws from a discrete distribution
+ */
+struct Alias
+{
+  int N;        //number of cells
+  double *prob; //probability of keeping the drawn cell
+  int *alias;   //cell taken instead
+};
+
+struct Alias *setup_alias_table(double *weight, int N);
+int draw_from_alias_table(struct Alias *table, gsl_rng *seed);
+void free_alias_table(struct Alias *table);
+
+/*
+ Gaussian mixture model for draws from (and densities of)
+ samples of an earlier run, keeping their correlations
+ */
+struct GMM
+{
+  int NP;         //dimension
+  int K;          //number of components
+  double *w;      //weight of each component
+  double *logN;   //log of weight over Gaussian normalization of each component
+  double **mu;    //mean of each component
+  double ***L;    //Cholesky factor of each component's covariance
+};
+
+struct GMM *alloc_gmm(int NP, int K);
+void normalize_gmm(struct GMM *gmm);
+struct GMM *fit_gmm(double **samples, int N, int NP, int K);
+double gmm_density(struct GMM *gmm, double *x);
+void draw_from_gmm(struct GMM *gmm, double *x, gsl_rng *seed);
+void free_gmm(struct GMM *gmm);
+
 #endif /* GalacticBinaryMath_h */
@@ -14,6 +14,7 @@
 #include "GalacticBinary.h"
 #include "GalacticBinaryMath.h"
 #include "GalacticBinaryModel.h"
+#include "GalacticBinaryRNG.h"
 #include "GalacticBinaryWaveform.h"
 
 #define FIXME 0
@@ -143,16 +144,27 @@ void initialize_chain(struct Chain *chain, struct Flags *flags, long *seed)
   int ic;
   int NC = chain->NC;
   char filename[1024];
+  
+  //a resumed run rewinds the existing chain files instead of clobbering them
+  char *mode = flags->resume ? "a" : "w";
 
   chain->index = malloc(NC*sizeof(int));
   chain->acceptance = malloc(NC*sizeof(double));
   chain->temperature = malloc(NC*sizeof(double));
   chain->avgLogL     = malloc(NC*sizeof(double));
   chain->dimension   = malloc(NC*sizeof(int *));
+  chain->direction   = malloc(NC*sizeof(int));
+  chain->roundTrips  = malloc(NC*sizeof(int));
+  chain->swapTrial   = malloc(NC*sizeof(int));
+  chain->swapReject  = malloc(NC*sizeof(double));
   for(ic=0; ic<NC; ic++)
   {
     chain->index[ic]=ic;
     chain->acceptance[ic] = 1.0;
+    chain->direction[ic]  = 0;
+    chain->roundTrips[ic] = 0;
+    chain->swapTrial[ic]  = 0;
+    chain->swapReject[ic] = 0.0;
     chain->temperature[ic] = pow(1.2,(double)ic);
     chain->avgLogL[ic] = 0.0;
     chain->dimension[ic] = malloc(flags->DMAX*sizeof(int));
@@ -162,42 +174,44 @@ void initialize_chain(struct Chain *chain, struct Flags *flags, long *seed)
   chain->temperature[NC-1] = 1e12;
   chain->logLmax = 0.0;
   
+  //first ladder update after 100 swaps per pair, doubling after each update
+  chain->ladderRound = 100;
+  
   chain->r = malloc(NC*sizeof(gsl_rng *));
   chain->T = malloc(NC*sizeof(const gsl_rng_type *));
   
+  //each chain draws from counter-based streams keyed by the chain seed
+  chain->seed = (unsigned long)(*seed);
   for(ic=0; ic<NC; ic++)
   {
-    chain->T[ic] = gsl_rng_default;
-    chain->r[ic] = gsl_rng_alloc(chain->T[ic]);
-    gsl_rng_env_setup();
-    gsl_rng_set (chain->r[ic], *seed);
-    *seed = (long)gsl_rng_get(chain->r[ic]);
+    chain->T[ic] = rng_philox;
+    chain->r[ic] = alloc_rng_stream(chain->seed, ic, 0, 0, RNG_INITIALIZE);
   }
   
-  chain->likelihoodFile = fopen("chains/log_likelihood_chain.dat","w");
+  chain->likelihoodFile = fopen("chains/log_likelihood_chain.dat",mode);
   
-  chain->temperatureFile = fopen("chains/temperature_chain.dat","w");
+  chain->temperatureFile = fopen("chains/temperature_chain.dat",mode);
   
   chain->chainFile = malloc(NC*sizeof(FILE *));
-  chain->chainFile[0] = fopen("chains/model_chain.dat.0","w");
+  chain->chainFile[0] = fopen("chains/model_chain.dat.0",mode);
 
   chain->parameterFile = malloc(NC*sizeof(FILE *));
-  chain->parameterFile[0] = fopen("chains/parameter_chain.dat.0","w");
+  chain->parameterFile[0] = fopen("chains/parameter_chain.dat.0",mode);
 
   chain->dimensionFile = malloc(flags->DMAX*sizeof(FILE *));
   for(int i=0; i<flags->DMAX; i++)
   {
     sprintf(filename,"chains/dimension_chain.dat.%i",i);
-    chain->dimensionFile[i] = fopen(filename,"w");
+    chain->dimensionFile[i] = fopen(filename,mode);
   }
   
   chain->noiseFile = malloc(NC*sizeof(FILE *));
-  chain->noiseFile[0] = fopen("chains/noise_chain.dat.0","w");
+  chain->noiseFile[0] = fopen("chains/noise_chain.dat.0",mode);
 
   if(flags->calibration)
   {
     chain->calibrationFile = malloc(NC*sizeof(FILE *));
-    chain->calibrationFile[0] = fopen("chains/calibration_chain.dat.0","w");
+    chain->calibrationFile[0] = fopen("chains/calibration_chain.dat.0",mode);
   }
 
   if(flags->verbose)
@@ -205,23 +219,40 @@ void initialize_chain(struct Chain *chain, struct Flags *flags, long *seed)
     for(ic=1; ic<NC; ic++)
     {
       sprintf(filename,"chains/parameter_chain.dat.%i",ic);
-      chain->parameterFile[ic] = fopen(filename,"w");
+      chain->parameterFile[ic] = fopen(filename,mode);
 
       sprintf(filename,"chains/model_chain.dat.%i",ic);
-      chain->chainFile[ic] = fopen(filename,"w");
+      chain->chainFile[ic] = fopen(filename,mode);
 
       sprintf(filename,"chains/noise_chain.dat.%i",ic);
-      chain->noiseFile[ic] = fopen(filename,"w");
+      chain->noiseFile[ic] = fopen(filename,mode);
     }
   }
 }
 
+int temperature_steps(struct Chain *chain, struct Flags *flags, int ic)
+{
+  /*
+   Source and noise updates per iteration for temperature ic.  The cold
+   chain gets the full 100, hotter chains (which only feed the swaps)
+   get fewer as log T grows, but never less than --hot-steps.
+   */
+  int steps = (int)(100./(1.+log(chain->temperature[ic])));
+  if(steps < flags->hotSteps) steps = flags->hotSteps;
+  if(steps > 100) steps = 100;
+  return steps;
+}
+
 void free_chain(struct Chain *chain, struct Flags *flags)
 {
   free(chain->index);
   free(chain->temperature);
   free(chain->acceptance);
   free(chain->avgLogL);
+  free(chain->direction);
+  free(chain->roundTrips);
+  free(chain->swapTrial);
+  free(chain->swapReject);
   
   for(int ic=0; ic<chain->NC; ic++) gsl_rng_free(chain->r[ic]);
   free(chain->r);
@@ -328,6 +359,126 @@ void copy_model(struct Model *origin, struct Model *copy)
   copy->logLnorm       = origin->logLnorm;
 }
 
+int model_state_size(struct Model *model)
+{
+  //Nlive, source parameters, per-segment noise/t0/calibration, likelihood
+  return 1 + model->Nmax*model->NP + model->NT*12 + 2;
+}
+
+void pack_model_state(struct Model *model, double *state)
+{
+  int k=0;
+
+  state[k++] = (double)model->Nlive;
+
+  for(int n=0; n<model->Nmax; n++)
+    for(int j=0; j<model->NP; j++) state[k++] = model->source[n]->params[j];
+
+  for(int m=0; m<model->NT; m++)
+  {
+    state[k++] = model->noise[m]->etaX;
+    state[k++] = model->noise[m]->etaA;
+    state[k++] = model->noise[m]->etaE;
+    state[k++] = model->t0[m];
+    state[k++] = model->t0_min[m];
+    state[k++] = model->t0_max[m];
+    state[k++] = model->calibration[m]->dampX;
+    state[k++] = model->calibration[m]->dampA;
+    state[k++] = model->calibration[m]->dampE;
+    state[k++] = model->calibration[m]->dphiX;
+    state[k++] = model->calibration[m]->dphiA;
+    state[k++] = model->calibration[m]->dphiE;
+  }
+
+  state[k++] = model->logL;
+  state[k++] = model->logLnorm;
+}
+
+/*
+ Restores the parameters written by pack_model_state().  The waveform,
+ noise and calibration models are not regenerated here.
+ */
+void unpack_model_state(struct Model *model, double *state, double T)
+{
+  int k=0;
+
+  model->Nlive = (int)state[k++];
+
+  for(int n=0; n<model->Nmax; n++)
+  {
+    for(int j=0; j<model->NP; j++) model->source[n]->params[j] = state[k++];
+    map_array_to_params(model->source[n], model->source[n]->params, T);
+  }
+
+  for(int m=0; m<model->NT; m++)
+  {
+    model->noise[m]->etaX = state[k++];
+    model->noise[m]->etaA = state[k++];
+    model->noise[m]->etaE = state[k++];
+    model->t0[m]          = state[k++];
+    model->t0_min[m]      = state[k++];
+    model->t0_max[m]      = state[k++];
+    model->calibration[m]->dampX = state[k++];
+    model->calibration[m]->dampA = state[k++];
+    model->calibration[m]->dampE = state[k++];
+    model->calibration[m]->dphiX = state[k++];
+    model->calibration[m]->dphiA = state[k++];
+    model->calibration[m]->dphiE = state[k++];
+  }
+
+  model->logL     = state[k++];
+  model->logLnorm = state[k++];
+}
+
+int fisher_state_size(struct Model *model)
+{
+  //matrix, eigenvectors, and eigenvalues of each source's Fisher matrix
+  //plus where it was computed and the Fisher jumps since
+  return model->Nmax*(model->NP*(2*model->NP+2) + 2);
+}
+
+void pack_fisher_state(struct Model *model, double *state)
+{
+  int k=0;
+  for(int n=0; n<model->Nmax; n++)
+  {
+    struct Source *source = model->source[n];
+    for(int i=0; i<model->NP; i++)
+    {
+      for(int j=0; j<model->NP; j++)
+      {
+        state[k++] = source->fisher_matrix[i][j];
+        state[k++] = source->fisher_evectr[i][j];
+      }
+      state[k++] = source->fisher_evalue[i];
+      state[k++] = source->fisher_params[i];
+    }
+    state[k++] = (double)source->fisher_trial;
+    state[k++] = (double)source->fisher_accept;
+  }
+}
+
+void unpack_fisher_state(struct Model *model, double *state)
+{
+  int k=0;
+  for(int n=0; n<model->Nmax; n++)
+  {
+    struct Source *source = model->source[n];
+    for(int i=0; i<model->NP; i++)
+    {
+      for(int j=0; j<model->NP; j++)
+      {
+        source->fisher_matrix[i][j] = state[k++];
+        source->fisher_evectr[i][j] = state[k++];
+      }
+      source->fisher_evalue[i] = state[k++];
+      source->fisher_params[i] = state[k++];
+    }
+    source->fisher_trial  = (int)state[k++];
+    source->fisher_accept = (int)state[k++];
+  }
+}
+
 int compare_model(struct Model *a, struct Model *b)
 {
   int err = 0;
@@ -468,6 +619,49 @@ int compare_model(struct Model *a, struct Model *b)
 
 
 
+void alloc_history(struct Model *model, struct Model *trial, int size)
+{
+  //one ring buffer per source slot, proposals on the trial model read the same history
+  for(int n=0; n<model->Nmax; n++)
+  {
+    struct History *history = malloc(sizeof(struct History));
+    history->size = size;
+    history->N    = 0;
+    history->next = 0;
+    history->params = malloc(size*sizeof(double *));
+    for(int k=0; k<size; k++) history->params[k] = malloc(model->NP*sizeof(double));
+
+    model->source[n]->history = history;
+    trial->source[n]->history = history;
+  }
+}
+
+void update_history(struct Model *model)
+{
+  for(int n=0; n<model->Nlive; n++)
+  {
+    struct History *history = model->source[n]->history;
+    if(history==NULL) continue;
+
+    for(int j=0; j<model->source[n]->NP; j++) history->params[history->next][j] = model->source[n]->params[j];
+    history->next = (history->next+1)%history->size;
+    if(history->N < history->size) history->N++;
+  }
+}
+
+void free_history(struct Model *model)
+{
+  for(int n=0; n<model->Nmax; n++)
+  {
+    struct History *history = model->source[n]->history;
+    if(history==NULL) continue;
+
+    for(int k=0; k<history->size; k++) free(history->params[k]);
+    free(history->params);
+    free(history);
+  }
+}
+
 void free_model(struct Model *model)
 {
   int n;
@@ -656,6 +850,8 @@ void alloc_source(struct Source *source, int NFFT, int Nchannel, int NP)
   source->dfdt=0.;
   source->d2fdt2=0.;
   
+  source->history = NULL;
+
   //Book-keeping
   source->BW   = NFFT;
   source->qmin = 0;
@@ -675,11 +871,14 @@ void alloc_source(struct Source *source, int NFFT, int Nchannel, int NP)
   source->fisher_matrix = malloc(NP*sizeof(double *));
   source->fisher_evectr = malloc(NP*sizeof(double *));
   source->fisher_evalue = malloc(NP*sizeof(double));
+  source->fisher_params = calloc(NP,sizeof(double));
   for(int i=0; i<NP; i++)
   {
     source->fisher_matrix[i] = malloc(NP*sizeof(double));
     source->fisher_evectr[i] = malloc(NP*sizeof(double));
   }
+  source->fisher_trial  = 0;
+  source->fisher_accept = 0;
 };
 
 void copy_source(struct Source *origin, struct Source *copy)
@@ -725,8 +924,11 @@ void copy_source(struct Source *origin, struct Source *copy)
       copy->fisher_evectr[i][j] = origin->fisher_evectr[i][j];
     }
     copy->fisher_evalue[i] = origin->fisher_evalue[i];
+    copy->fisher_params[i] = origin->fisher_params[i];
     copy->params[i]        = origin->params[i];
   }
+  copy->fisher_trial  = origin->fisher_trial;
+  copy->fisher_accept = origin->fisher_accept;
 }
 
 void free_source(struct Source *source)
@@ -740,6 +942,7 @@ void free_source(struct Source *source)
   free(source->fisher_matrix);
   free(source->fisher_evectr);
   free(source->fisher_evalue);
+  free(source->fisher_params);
   free(source->params);
   
   free_tdi(source->tdi);
@@ -825,7 +1028,8 @@ void generate_signal_model(struct Orbit *orbit, struct Data *data, struct Model
     {
       //Simulate gravitational wave signal
       /* the index = -1 condition is redundent if the model->tdi structure is up to date...*/
-      if(index==-1 || index==n) galactic_binary(orbit, data->format, data->T, model->t0[m], source->params, source->NP, source->tdi->X, source->tdi->A, source->tdi->E, source->BW, source->tdi->Nchannel);
+      /* ...but source->tdi only holds the last segment, so with NT>1 every source is rebuilt */
+      if(index==-1 || index==n || NT>1) galactic_binary(orbit, data->format, data->T, model->t0[m], source->params, source->NP, source->tdi->X, source->tdi->A, source->tdi->E, source->BW, source->tdi->Nchannel);
       
       //Add waveform to model TDI channels
       for(i=0; i<source->BW; i++)
@@ -853,6 +1057,53 @@ void generate_signal_model(struct Orbit *orbit, struct Data *data, struct Model
   }//loop over sources
 }
 
+void generate_signal_segment(struct Orbit *orbit, struct Data *data, struct Model *model, int m)
+{
+  /*
+   Rebuild time segment m only (e.g. after its start time moved).  Source
+   parameters are unchanged, so their alignment in frequency is still good.
+   */
+  int i,j,n;
+  int N2=data->N*2;
+  struct Source *source;
+  
+  for(n=0; n<N2; n++)
+  {
+    model->tdi[m]->X[n]=0.0;
+    model->tdi[m]->A[n]=0.0;
+    model->tdi[m]->E[n]=0.0;
+  }
+  
+  for(n=0; n<model->Nlive; n++)
+  {
+    source = model->source[n];
+    
+    galactic_binary(orbit, data->format, data->T, model->t0[m], source->params, source->NP, source->tdi->X, source->tdi->A, source->tdi->E, source->BW, source->tdi->Nchannel);
+    
+    for(i=0; i<source->BW; i++)
+    {
+      j = i+source->imin;
+      
+      if(j>-1 && j<data->N)
+      {
+        int i_re = 2*i;
+        int i_im = i_re+1;
+        int j_re = 2*j;
+        int j_im = j_re+1;
+        
+        model->tdi[m]->X[j_re] += source->tdi->X[i_re];
+        model->tdi[m]->X[j_im] += source->tdi->X[i_im];
+        
+        model->tdi[m]->A[j_re] += source->tdi->A[i_re];
+        model->tdi[m]->A[j_im] += source->tdi->A[i_im];
+        
+        model->tdi[m]->E[j_re] += source->tdi->E[i_re];
+        model->tdi[m]->E[j_im] += source->tdi->E[i_im];
+      }
+    }
+  }
+}
+
 void generate_noise_model(struct Data *data, struct Model *model)
 {
   for(int m=0; m<model->NT; m++)
@@ -899,7 +1150,7 @@ void generate_calibration_model(struct Data *data, struct Model *model)
   }
 }
 
-void apply_calibration_model(struct Data *data, struct Model *model)
+void apply_calibration_segment(struct Data *data, struct Model *model, int m)
 {
   double dA;
   double cal_re;
@@ -908,57 +1159,59 @@ void apply_calibration_model(struct Data *data, struct Model *model)
   double h_im;
   int i_re;
   int i_im;
-  int i,m;
+  int i;
   
-  //apply calibration error to full signal model
-  //loop over time segments
-  for(m=0; m<model->NT; m++)
+  for(i=0; i<data->N; i++)
   {
-    for(i=0; i<data->N; i++)
+    i_re = 2*i;
+    i_im = i_re+1;
+    
+    switch(data->Nchannel)
     {
-      i_re = 2*i;
-      i_im = i_re+1;
-      
-      switch(data->Nchannel)
-      {
-        case 1:
-          h_re = model->tdi[m]->X[i_re];
-          h_im = model->tdi[m]->X[i_im];
-     
-          dA     = (1.0 + model->calibration[m]->dampX);
-          cal_re = model->calibration[m]->real_dphiX;
-          cal_im = model->calibration[m]->imag_dphiX;
-
-          model->tdi[m]->X[i_re] = dA*(h_re*cal_re - h_im*cal_im);
-          model->tdi[m]->X[i_im] = dA*(h_re*cal_im + h_im*cal_re);
-          break;
-        case 2:
-          h_re = model->tdi[m]->A[i_re];
-          h_im = model->tdi[m]->A[i_im];
-          
-          dA     = (1.0 + model->calibration[m]->dampA);
-          cal_re = model->calibration[m]->real_dphiA;
-          cal_im = model->calibration[m]->imag_dphiA;
-          
-          model->tdi[m]->A[i_re] = dA*(h_re*cal_re - h_im*cal_im);
-          model->tdi[m]->A[i_im] = dA*(h_re*cal_im + h_im*cal_re);
+      case 1:
+        h_re = model->tdi[m]->X[i_re];
+        h_im = model->tdi[m]->X[i_im];
+   
+        dA     = (1.0 + model->calibration[m]->dampX);
+        cal_re = model->calibration[m]->real_dphiX;
+        cal_im = model->calibration[m]->imag_dphiX;
+
+        model->tdi[m]->X[i_re] = dA*(h_re*cal_re - h_im*cal_im);
+        model->tdi[m]->X[i_im] = dA*(h_re*cal_im + h_im*cal_re);
+        break;
+      case 2:
+        h_re = model->tdi[m]->A[i_re];
+        h_im = model->tdi[m]->A[i_im];
+        
+        dA     = (1.0 + model->calibration[m]->dampA);
+        cal_re = model->calibration[m]->real_dphiA;
+        cal_im = model->calibration[m]->imag_dphiA;
+        
+        model->tdi[m]->A[i_re] = dA*(h_re*cal_re - h_im*cal_im);
+        model->tdi[m]->A[i_im] = dA*(h_re*cal_im + h_im*cal_re);
 
-          
-          h_re = model->tdi[m]->E[i_re];
-          h_im = model->tdi[m]->E[i_im];
-          
-          dA     = (1.0 + model->calibration[m]->dampE);
-          cal_re = model->calibration[m]->real_dphiE;
-          cal_im = model->calibration[m]->imag_dphiE;
-          
-          model->tdi[m]->E[i_re] = dA*(h_re*cal_re - h_im*cal_im);
-          model->tdi[m]->E[i_im] = dA*(h_re*cal_im + h_im*cal_re);
-          break;
-        default:
-          break;
-      }//end switch
-    }//end loop over data
-  }//end loop over segments
+        
+        h_re = model->tdi[m]->E[i_re];
+        h_im = model->tdi[m]->E[i_im];
+        
+        dA     = (1.0 + model->calibration[m]->dampE);
+        cal_re = model->calibration[m]->real_dphiE;
+        cal_im = model->calibration[m]->imag_dphiE;
+        
+        model->tdi[m]->E[i_re] = dA*(h_re*cal_re - h_im*cal_im);
+        model->tdi[m]->E[i_im] = dA*(h_re*cal_im + h_im*cal_re);
+        break;
+      default:
+        break;
+    }//end switch
+  }//end loop over data
+}
+
+void apply_calibration_model(struct Data *data, struct Model *model)
+{
+  //apply calibration error to full signal model
+  //loop over time segments
+  for(int m=0; m<model->NT; m++) apply_calibration_segment(data, model, m);
 }
 
 double gaussian_log_likelihood(struct Orbit *orbit, struct Data *data, struct Model *model)
@@ -1013,6 +1266,46 @@ double gaussian_log_likelihood(struct Orbit *orbit, struct Data *data, struct Mo
   return logL;
 }
 
+double gaussian_log_likelihood_band(struct Data *data, struct Model *model, int m, int imin, int imax)
+{
+  /*
+   Residual power of time segment m in bins [imin,imax).  Differences of
+   this between two models that only disagree inside the band are the
+   change in log likelihood.
+   */
+  double arg = 0.0;
+  
+  for(int i=imin; i<imax; i++)
+  {
+    int i_re = 2*i;
+    int i_im = i_re+1;
+    double r_re, r_im;
+    
+    switch(data->Nchannel)
+    {
+      case 1:
+        r_re = data->tdi[m]->X[i_re] - model->tdi[m]->X[i_re];
+        r_im = data->tdi[m]->X[i_im] - model->tdi[m]->X[i_im];
+        arg += (r_re*r_re + r_im*r_im)/model->noise[m]->SnX[i];
+        break;
+      case 2:
+        r_re = data->tdi[m]->A[i_re] - model->tdi[m]->A[i_re];
+        r_im = data->tdi[m]->A[i_im] - model->tdi[m]->A[i_im];
+        arg += (r_re*r_re + r_im*r_im)/model->noise[m]->SnA[i];
+        r_re = data->tdi[m]->E[i_re] - model->tdi[m]->E[i_re];
+        r_im = data->tdi[m]->E[i_im] - model->tdi[m]->E[i_im];
+        arg += (r_re*r_re + r_im*r_im)/model->noise[m]->SnE[i];
+        break;
+      default:
+        fprintf(stderr,"Unsupported number of channels in gaussian_log_likelihood_band()\n");
+        exit(1);
+    }
+  }
+  
+  //same normalization as fourier_nwip
+  return -0.5*4.0*arg;
+}
+
 double gaussian_log_likelihood_constant_norm(struct Data *data, struct Model *model)
 {
   
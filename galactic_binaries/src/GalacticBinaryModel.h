@@ -11,13 +11,19 @@
 
 #include <stdio.h>
 
+//past states kept per source slot for differential evolution (one per iteration)
+#define HISTORY_SIZE 500
+
 void simualte_data(struct Data *data, struct Flags *flags, struct Source **injections, int Ninj);
 void generate_signal_model(struct Orbit *orbit, struct Data *data, struct Model *model, int index);
+void generate_signal_segment(struct Orbit *orbit, struct Data *data, struct Model *model, int m);
 void generate_noise_model(struct Data *data, struct Model *model);
 void generate_calibration_model(struct Data *data, struct Model *model);
 void apply_calibration_model(struct Data *data, struct Model *model);
+void apply_calibration_segment(struct Data *data, struct Model *model, int m);
 
 double gaussian_log_likelihood(struct Orbit *orbit, struct Data *data, struct Model *model);
+double gaussian_log_likelihood_band(struct Data *data, struct Model *model, int m, int imin, int imax);
 double gaussian_log_likelihood_constant_norm(struct Data *data, struct Model *model);
 double gaussian_log_likelihood_model_norm(struct Data *data, struct Model *model);
 
@@ -29,25 +35,37 @@ void map_array_to_params(struct Source *source, double *params, double T);
 void alloc_data(struct Data **data_vec, struct Flags *flags);
 
 void initialize_chain(struct Chain *chain, struct Flags *flags, long *seed);
+int temperature_steps(struct Chain *chain, struct Flags *flags, int ic);
 void alloc_model(struct Model *model, int Nmax, int NFFT, int Nchannel, int NP, int NT);
 void alloc_noise(struct Noise *noise, int NFFT);
 void alloc_tdi(struct TDI *tdi, int NFFT, int Nchannel);
 void alloc_source(struct Source *source, int NFFT, int Nchannel, int NP);
 void alloc_calibration(struct Calibration *calibration);
+void alloc_history(struct Model *model, struct Model *trial, int size);
 
 int compare_model(struct Model *a, struct Model *b);
 
+void update_history(struct Model *model);
+
 void copy_source(struct Source *origin, struct Source *copy);
 void copy_model(struct Model *origin, struct Model *copy);
 void copy_tdi(struct TDI *origin, struct TDI *copy);
 void copy_noise(struct Noise *origin, struct Noise *copy);
 void copy_calibration(struct Calibration *origin, struct Calibration *copy);
 
+int model_state_size(struct Model *model);
+void pack_model_state(struct Model *model, double *state);
+void unpack_model_state(struct Model *model, double *state, double T);
+int fisher_state_size(struct Model *model);
+void pack_fisher_state(struct Model *model, double *state);
+void unpack_fisher_state(struct Model *model, double *state);
+
 void free_tdi(struct TDI *tdi);
 void free_noise(struct Noise *noise);
 void free_model(struct Model *model);
 void free_source(struct Source *source);
 void free_chain(struct Chain *chain, struct Flags *flags);
 void free_calibration(struct Calibration *calibration);
+void free_history(struct Model *model);
 
 #endif /* GalacticBinaryModel_h */
@@ -15,6 +15,7 @@
 #include "GalacticBinaryIO.h"
 #include "GalacticBinaryWaveform.h"
 #include "GalacticBinaryPrior.h"
+#include "GalacticBinaryRNG.h"
 
 static double loglike(double *x, int D)
 {
@@ -76,12 +77,8 @@ void set_galaxy_prior(struct Flags *flags, struct Prior *prior)
     MCMC/=10;
   }
   
-  const gsl_rng_type * T;
-  gsl_rng * r;
-  gsl_rng_env_setup();
-  
-  T = gsl_rng_default;
-  r = gsl_rng_alloc (T);
+  //the sky prior does not depend on the data, so always use the same stream
+  gsl_rng *r = alloc_rng_stream(0, 0, 0, 0, RNG_PRIOR);
   
   x =  (double*)malloc(sizeof(double)* D);
   xe = (double*)malloc(sizeof(double)* D);
@@ -258,6 +255,23 @@ void set_galaxy_prior(struct Flags *flags, struct Prior *prior)
   
 }
 
+void set_fdot_prior(struct Flags *flags, double fmin, double fmax, double T, double *fdotmin, double *fdotmax)
+{
+  /* emprical envolope functions from Gijs' MLDC catalog */
+  *fdotmin = -0.000005*pow(fmin,(13./3.));
+  *fdotmax = 0.0000008*pow(fmax,(11./3.));
+  
+  /* use prior on chirp mass to convert to priors on frequency evolution */
+  if(flags->detached)
+  {
+    double Mcmin = 0.15;
+    double Mcmax = 1.00;
+    
+    *fdotmin = galactic_binary_fdot(Mcmin, fmin, T);
+    *fdotmax = galactic_binary_fdot(Mcmax, fmax, T);
+  }
+}
+
 void set_uniform_prior(struct Flags *flags, struct Model *model, struct Data *data, int verbose)
 {
   /*
@@ -317,19 +331,8 @@ void set_uniform_prior(struct Flags *flags, struct Model *model, struct Data *da
   double fmin = model->prior[0][0]/data->T;
   double fmax = model->prior[0][1]/data->T;
   
-  /* emprical envolope functions from Gijs' MLDC catalog */
-  double fdotmin = -0.000005*pow(fmin,(13./3.));
-  double fdotmax = 0.0000008*pow(fmax,(11./3.));
-  
-  /* use prior on chirp mass to convert to priors on frequency evolution */
-  if(flags->detached)
-  {
-    double Mcmin = 0.15;
-    double Mcmax = 1.00;
-    
-    fdotmin = galactic_binary_fdot(Mcmin, fmin, data->T);
-    fdotmax = galactic_binary_fdot(Mcmax, fmax, data->T);
-  }
+  double fdotmin,fdotmax;
+  set_fdot_prior(flags, fmin, fmax, data->T, &fdotmin, &fdotmax);
   
   double fddotmin = 11.0/3.0*fdotmin*fdotmin/fmax;
   double fddotmax = 11.0/3.0*fdotmax*fdotmax/fmin;
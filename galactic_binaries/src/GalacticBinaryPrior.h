@@ -53,9 +53,11 @@ struct Prior
   double skymaxp;
   int ncostheta;
   int nphi;
+  struct Alias *skyalias; //skyhist cells for draw_from_galaxy_prior()
 };
 
 void set_galaxy_prior(struct Flags *flags, struct Prior *prior);
+void set_fdot_prior(struct Flags *flags, double fmin, double fmax, double T, double *fdotmin, double *fdotmax);
 void set_uniform_prior(struct Flags *flags, struct Model *model, struct Data *data, int verbose);
 double evaluate_prior(struct Flags *flags, struct Data *data, struct Model *model, struct Prior *prior, double *params);
 double evaluate_snr_prior(struct Data *data, struct Model *model, double *params);
@@ -7,17 +7,21 @@
 //
 
 #include <math.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <gsl/gsl_rng.h>
-#include <gsl/gsl_sort.h>
 #include <gsl/gsl_randist.h>
 
 #include "LISA.h"
 #include "Constants.h"
 #include "GalacticBinary.h"
 #include "GalacticBinaryIO.h"
+#include "GalacticBinaryMath.h"
 #include "GalacticBinaryPrior.h"
 #include "GalacticBinaryModel.h"
 #include "GalacticBinaryWaveform.h"
@@ -27,6 +31,10 @@
 
 #define FIXME 0
 #define SNRCAP 10000.0 /* SNR cap on logL */
+#define FSTAT_REFINE 0.1 /* refine F-statistic cells within this fraction of the loudest */
+#define FSTAT_REFINE_CELLS 512 /* most F-statistic cells split per refinement level */
+#define FSTAT_FDOT_MISMATCH 0.3 /* F-statistic mismatch allowed halfway between fdot layers */
+#define FSTAT_FDOT_LAYERS 32 /* most fdot layers in the F-statistic grid */
 
 
 static void write_Fstat_animation(double fmin, double T, struct Proposal *proposal)
@@ -162,13 +170,43 @@ void setup_frequency_proposal(struct Data *data)
 
 void print_acceptance_rates(struct Proposal **proposal, int NP, int ic, FILE *fptr)
 {
-  fprintf(fptr,"Acceptance rates for chain %i:\n", ic);
+  fprintf(fptr,"Acceptance rates for chain %i (rate, weight, CPU s/move):\n", ic);
   for(int n=0; n<NP+1; n++)
   {
-    fprintf(fptr,"   %.1e  [%s]\n", (double)proposal[n]->accept[ic]/(double)proposal[n]->trial[ic],proposal[n]->name);
+    fprintf(fptr,"   %.1e  %.2f  %.1e  [%s]\n", (double)proposal[n]->accept[ic]/(double)proposal[n]->trial[ic], proposal[n]->weight, proposal[n]->time[ic]/(double)proposal[n]->trial[ic], proposal[n]->name);
   }
 }
 
+//rebuild the cumulative weights used by select_proposal()
+void set_proposal_table(struct Proposal **proposal, int NP)
+{
+  double total = 0.0;
+  for(int n=0; n<NP+1; n++)
+  {
+    total += proposal[n]->weight;
+    proposal[n]->cumulative = total;
+  }
+  for(int n=0; n<NP+1; n++) proposal[n]->cumulative /= total;
+}
+
+/*
+ One uniform draw against the cumulative weights (zero-weight proposals are never picked).
+ The table has one entry per proposal slot (at most 8), so a linear scan is as cheap
+ as a guide or alias table would be, and it costs nothing to rebuild when the weights adapt.
+ */
+int select_proposal(struct Proposal **proposal, int NP, gsl_rng *seed)
+{
+  double u = gsl_rng_uniform(seed);
+  int n = 0;
+  while(n<NP && u >= proposal[n]->cumulative) n++;
+  return n;
+}
+
+double symmetric_density(UNUSED struct Data *data, UNUSED struct Model *model, UNUSED struct Source *source, UNUSED struct Proposal *proposal, UNUSED double *params)
+{
+  return 0.0;
+}
+
 double draw_from_spectrum(struct Data *data, struct Model *model, struct Source *source, UNUSED struct Proposal *proposal, double *params, gsl_rng *seed)
 {
   //TODO: Work in amplitude
@@ -278,30 +316,58 @@ double draw_from_extrinsic_prior(UNUSED struct Data *data, struct Model *model,
   return logP;
 }
 
+/*
+ galaxy sky proposal
+ -alias table over the skyhist cells of set_galaxy_prior(),
+  each weighted by its density (the cells have equal area)
+ -a cell is drawn in constant time, then a point within it
+ */
+void setup_galaxy_prior_proposal(struct Prior *prior)
+{
+  int Ncell = prior->ncostheta*prior->nphi;
+  double *weight = malloc(Ncell*sizeof(double));
+  for(int k=0; k<Ncell; k++) weight[k] = exp(prior->skyhist[k]-prior->skymaxp);
+  prior->skyalias = setup_alias_table(weight, Ncell);
+  free(weight);
+}
+
 double draw_from_galaxy_prior(struct Model *model, struct Prior *prior, double *params, gsl_rng *seed)
 {
   double **uniform_prior = model->prior;
   double logP=-INFINITY;
-  double alpha=prior->skymaxp;
   
-  while(alpha>logP)
+  //cells outside a reduced sky range are redrawn
+  while(logP==-INFINITY)
   {
-    //sky location
-    params[1] = model->prior[1][0] + gsl_rng_uniform(seed)*(model->prior[1][1]-model->prior[1][0]);
-    params[2] = model->prior[2][0] + gsl_rng_uniform(seed)*(model->prior[2][1]-model->prior[2][0]);
-    
-    //map costheta and phi to index of skyhist array
-    int i = (int)floor((params[1]-uniform_prior[1][0])/prior->dcostheta);
-    int j = (int)floor((params[2]-uniform_prior[2][0])/prior->dphi);
+    int k = draw_from_alias_table(prior->skyalias, seed);
+    int i = k/prior->nphi;
+    int j = k%prior->nphi;
     
-    int k = i*prior->nphi + j;
+    //sky location
+    params[1] = uniform_prior[1][0] + ((double)i + gsl_rng_uniform(seed))*prior->dcostheta;
+    params[2] = uniform_prior[2][0] + ((double)j + gsl_rng_uniform(seed))*prior->dphi;
     
-    logP = prior->skyhist[k];
-    alpha = log(gsl_rng_uniform(seed)*exp(prior->skymaxp));
+    logP = galaxy_prior_density(model, prior, params);
   }
   return logP;
 }
 
+//log density of the galaxy sky proposal, the skyhist cell holding params
+double galaxy_prior_density(struct Model *model, struct Prior *prior, double *params)
+{
+  double **uniform_prior = model->prior;
+  
+  if(params[1]<uniform_prior[1][0] || params[1]>=uniform_prior[1][1]) return -INFINITY;
+  if(params[2]<uniform_prior[2][0] || params[2]>=uniform_prior[2][1]) return -INFINITY;
+  
+  //map costheta and phi to index of skyhist array
+  int i = (int)floor((params[1]-uniform_prior[1][0])/prior->dcostheta);
+  int j = (int)floor((params[2]-uniform_prior[2][0])/prior->dphi);
+  if(i>prior->ncostheta-1 || j>prior->nphi-1) return -INFINITY;
+  
+  return prior->skyhist[i*prior->nphi + j];
+}
+
 double draw_calibration_parameters(struct Data *data, struct Model *model, gsl_rng *seed)
 {
   double dA,dphi;
@@ -476,63 +542,196 @@ double draw_from_fisher(UNUSED struct Data *data, struct Model *model, struct So
   return 0.0;
 }
 
-double draw_from_cdf(UNUSED struct Data *data, struct Model *model, struct Source *source, struct Proposal *proposal, double *params, gsl_rng *seed)
+double differential_evolution(struct Data *data, struct Model *model, struct Source *source, struct Proposal *proposal, double *params, gsl_rng *seed)
 {
-  int N = proposal->size;
   int NP = source->NP;
-  double **cdf = proposal->matrix;
+  struct History *history = source->history;
+  
+  //need two past states of this source slot
+  if(history==NULL || history->N<2) return draw_from_fisher(data, model, source, proposal, params, seed);
+  
+  int a = (int)(gsl_rng_uniform(seed)*(double)history->N);
+  int b = (int)(gsl_rng_uniform(seed)*(double)(history->N-1));
+  if(b>=a) b++;
+  
+  //optimal scaling for gaussian posteriors, with occasional full-length jumps between modes
+  double gamma = 2.38/sqrt(2.*(double)NP);
+  if(gsl_rng_uniform(seed)<0.1) gamma = 1.0;
+  
+  for(int j=0; j<NP; j++) params[j] = source->params[j] + gamma*(history->params[a][j] - history->params[b][j]);
+  
+  //differential evolution is symmetric
+  return 0.0;
+}
 
-  for(int n=0; n<NP; n++)
-  {
+//mixture draws allowed to land outside the prior before falling back to a prior draw
+#define CDF_MAX_DRAWS 100
 
-    //draw n from U[0,N]
-    double c_prime = gsl_rng_uniform(seed)*(double)(N-1);
-    
-    //map to nearest sample
-    int c_minus = (int)floor(c_prime);
-    int c_plus  = c_minus+1;
-    
-    //get value of pdf at cprime
-    double p = 1./(cdf[n][c_plus] - cdf[n][c_minus]);
-    
-    //interpolate to get new parameter
-    params[n] = (c_prime - c_minus)*(1./p) + cdf[n][c_minus];
+double draw_from_cdf(UNUSED struct Data *data, struct Model *model, struct Source *source, struct Proposal *proposal, double *params, gsl_rng *seed)
+{
+  int NP = source->NP;
+  
+  /*
+   The mixture's tails reach past the prior, so redraw until every parameter is inside it.
+   The density is then the truncated mixture, whose normalization cancels in the Hastings ratio.
+   */
+  for(int draw=0; draw<CDF_MAX_DRAWS; draw++)
+  {
+    draw_from_gmm(proposal->gmm, params, seed);
     
-    if(params[n]<model->prior[n][0] || params[n]>=model->prior[n][1]) return -INFINITY;
+    int inside = 1;
+    for(int n=0; n<NP; n++)
+      if(params[n]<model->prior[n][0] || params[n]>=model->prior[n][1]) inside = 0;
     
+    if(inside) return cdf_density(data, model, source, proposal, params);
   }
-
-  return cdf_density(model, source, proposal);
+  
+  //mixture has almost no mass inside the prior
+  return draw_from_prior(data, model, source, proposal, params, seed);
 }
 
-double cdf_density(struct Model *model, struct Source *source, struct Proposal *proposal)
+double cdf_density(UNUSED struct Data *data, struct Model *model, struct Source *source, struct Proposal *proposal, double *params)
 {
-  int N = proposal->size;
   int NP = source->NP;
-  double **cdf = proposal->matrix;
-  double logP=0.0;
-  double *params = source->params;
-  
-  int i,j;
   
   for(int n=0; n<NP; n++)
-  {
     if(params[n]<model->prior[n][0] || params[n]>=model->prior[n][1]) return -INFINITY;
+  
+  return gmm_density(proposal->gmm, params);
+}
 
-    //find samples either end of p-value
-    if(params[n]<cdf[n][0] || params[n]>= cdf[n][N-1])
-      return -INFINITY;
-    else
-    {
-      i=0;
-      while(params[n]>cdf[n][i]) i++;
-      j=i+1;
-      while(cdf[n][j]==cdf[n][i]) j++;
-      logP += log(  ((double)(j-i)/N) /  (cdf[n][j]-cdf[n][i])  );
-    }
+/*
+ cdf proposal
+ -Gaussian mixture fit to the chain of an earlier run
+ -the fit is saved in update_mixture.dat, which
+  --update also accepts in place of a chain file
+ -file is a header followed by each component's
+  weight, mean and lower-triangular Cholesky factor
+ */
+#define CDF_MODES 8
+#define CDF_FILE_VERSION 1
+
+struct CdfFileHeader
+{
+  char magic[8];
+  int version;
+  int NP;
+  int K;
+};
+
+static struct GMM *load_cdf_mixture(char *filename, int NP)
+{
+  FILE *fptr = fopen(filename,"rb");
+  if(fptr==NULL) return NULL;
+  
+  struct CdfFileHeader header;
+  if(fread(&header, sizeof(header), 1, fptr)!=1 || strncmp(header.magic,"GBGMM",8))
+  {
+    fclose(fptr);
+    return NULL;
+  }
+  if(header.version!=CDF_FILE_VERSION || header.NP!=NP)
+  {
+    fprintf(stderr,"%s is a version %i, %i parameter mixture (expected version %i, %i parameters)\n",filename,header.version,header.NP,CDF_FILE_VERSION,NP);
+    exit(1);
   }
   
-  return logP;
+  struct GMM *gmm = alloc_gmm(NP, header.K);
+  int err = 0;
+  for(int k=0; k<gmm->K; k++)
+  {
+    err += (fread(&gmm->w[k], sizeof(double), 1, fptr) != 1);
+    err += (fread(gmm->mu[k], sizeof(double), NP, fptr) != (size_t)NP);
+    for(int i=0; i<NP; i++) err += (fread(gmm->L[k][i], sizeof(double), i+1, fptr) != (size_t)(i+1));
+  }
+  fclose(fptr);
+  
+  if(err)
+  {
+    fprintf(stderr,"%s is truncated\n",filename);
+    exit(1);
+  }
+  normalize_gmm(gmm);
+  
+  return gmm;
+}
+
+static void save_cdf_mixture(char *filename, struct GMM *gmm)
+{
+  struct CdfFileHeader header;
+  memset(&header, 0, sizeof(header));
+  sprintf(header.magic,"GBGMM");
+  header.version = CDF_FILE_VERSION;
+  header.NP      = gmm->NP;
+  header.K       = gmm->K;
+  
+  FILE *fptr = fopen(filename,"wb");
+  if(fptr==NULL)
+  {
+    fprintf(stderr,"WARNING: could not write cdf mixture %s\n",filename);
+    return;
+  }
+  int err = (fwrite(&header, sizeof(header), 1, fptr) != 1);
+  for(int k=0; k<gmm->K; k++)
+  {
+    err += (fwrite(&gmm->w[k], sizeof(double), 1, fptr) != 1);
+    err += (fwrite(gmm->mu[k], sizeof(double), gmm->NP, fptr) != (size_t)gmm->NP);
+    for(int i=0; i<gmm->NP; i++) err += (fwrite(gmm->L[k][i], sizeof(double), i+1, fptr) != (size_t)(i+1));
+  }
+  err += (fclose(fptr) != 0);
+  
+  if(err) fprintf(stderr,"WARNING: could not write cdf mixture %s\n",filename);
+}
+
+static void setup_cdf_proposal(struct Data *data, struct Flags *flags, struct Proposal *proposal, int NMAX)
+{
+  fprintf(stdout,"\n============== cdf proposal ==============\n");
+  
+  proposal->gmm = load_cdf_mixture(flags->cdfFile, data->NP);
+  if(proposal->gmm)
+  {
+    fprintf(stdout,"   mixture = %s\n",flags->cdfFile);
+    fprintf(stdout,"   modes   = %i\n",proposal->gmm->K);
+    fprintf(stdout,"==========================================\n");
+    return;
+  }
+  
+  //parse chain file
+  FILE *fptr = fopen(flags->cdfFile,"r");
+  proposal->size=0;
+  double junk;
+  while(!feof(fptr))
+  {
+    for(int j=0; j<data->NP; j++) fscanf(fptr,"%lg",&junk);
+    proposal->size++;
+  }
+  rewind(fptr);
+  proposal->size--;
+  
+  double **samples = malloc(proposal->size*sizeof(double *));
+  
+  struct Model *temp = malloc(sizeof(struct Model));
+  alloc_model(temp,NMAX,data->N,data->Nchannel, data->NP, data->NT);
+  
+  for(int n=0; n<proposal->size; n++)
+  {
+    samples[n] = malloc(data->NP*sizeof(double));
+    scan_source_params(data, temp->source[0], fptr);
+    for(int j=0; j<data->NP; j++) samples[n][j] = temp->source[0]->params[j];
+  }
+  free_model(temp);
+  fclose(fptr);
+  
+  //fit the mixture and keep it for later runs
+  proposal->gmm = fit_gmm(samples, proposal->size, data->NP, CDF_MODES);
+  save_cdf_mixture("update_mixture.dat", proposal->gmm);
+  
+  fprintf(stdout,"   samples = %i\n",proposal->size);
+  fprintf(stdout,"   modes   = %i\n",proposal->gmm->K);
+  fprintf(stdout,"==========================================\n");
+  
+  for(int n=0; n<proposal->size; n++) free(samples[n]);
+  free(samples);
 }
 
 
@@ -586,16 +785,22 @@ void initialize_proposal(struct Orbit *orbit, struct Data *data, struct Chain *c
     
     proposal[i]->trial  = malloc(NC*sizeof(int));
     proposal[i]->accept = malloc(NC*sizeof(int));
+    proposal[i]->time   = malloc(NC*sizeof(double));
     
     for(int ic=0; ic<NC; ic++)
     {
       proposal[i]->trial[ic]  = 1;
       proposal[i]->accept[ic] = 0;
+      proposal[i]->time[ic]   = 0.0;
     }
     
+    proposal[i]->id      = i;
+    proposal[i]->draw    = NULL;
+    proposal[i]->density = &symmetric_density;
+    
     switch(i)
     {
-      case 0:
+      case PROPOSAL_DR:
         /*
          delayed rejection proposal does not fit in with others' protocal
          -must have zero weight
@@ -605,89 +810,56 @@ void initialize_proposal(struct Orbit *orbit, struct Data *data, struct Chain *c
         proposal[i]->weight = 0.0;
         break;
         
-      case 1:
-        sprintf(proposal[i]->name,"prior");
-        proposal[i]->function = &draw_from_prior;
+      case PROPOSAL_MTM:
+        /*
+         multiple-try move is called on its own (like delayed rejection)
+         -must have zero weight
+         */
+        sprintf(proposal[i]->name,"multiple try");
         proposal[i]->weight = 0.0;
         check+=proposal[i]->weight;
         break;
-      case 2:
+      case PROPOSAL_FSTAT:
         sprintf(proposal[i]->name,"fstat");
         
         
         setup_fstatistic_proposal(orbit, data, flags, proposal[i]);
 
-        proposal[i]->function = &jump_from_fstatistic;
+        proposal[i]->draw    = &jump_from_fstatistic;
+        proposal[i]->density = &fstatistic_density;
         proposal[i]->weight = 0.2;
         check+=proposal[i]->weight;
         break;
-      case 3:
+      case PROPOSAL_EXTRINSIC:
         sprintf(proposal[i]->name,"extrinsic prior");
-        proposal[i]->function = &draw_from_extrinsic_prior;
+        proposal[i]->draw = &draw_from_extrinsic_prior;
         proposal[i]->weight = 0.0;
         check+=proposal[i]->weight;
         break;
-      case 4:
+      case PROPOSAL_FISHER:
         sprintf(proposal[i]->name,"fisher");
-        proposal[i]->function = &draw_from_fisher;
+        proposal[i]->draw = &draw_from_fisher;
         proposal[i]->weight = 1.0; //that's a 1 all right.  don't panic
         break;
-      case 5:
+      case PROPOSAL_FM_SHIFT:
         sprintf(proposal[i]->name,"fm shift");
-        proposal[i]->function = &fm_shift;
+        proposal[i]->draw = &fm_shift;
         proposal[i]->weight = 0.2;
         check+=proposal[i]->weight;
         break;
-      case 6:
+      case PROPOSAL_DE:
+        sprintf(proposal[i]->name,"diff evolution");
+        proposal[i]->draw = &differential_evolution;
+        proposal[i]->weight = 0.3;
+        check+=proposal[i]->weight;
+        break;
+      case PROPOSAL_CDF:
         sprintf(proposal[i]->name,"cdf draw");
-        proposal[i]->function = &draw_from_cdf;
+        proposal[i]->draw    = &draw_from_cdf;
+        proposal[i]->density = &cdf_density;
         proposal[i]->weight = 0.2;
         check+=proposal[i]->weight;
-        //parse chain file
-        FILE *fptr = fopen(flags->cdfFile,"r");
-        proposal[i]->size=0;
-        double junk;
-        while(!feof(fptr))
-        {
-          //fscanf(fptr,"%lg",&junk);
-          for(int j=0; j<data->NP; j++) fscanf(fptr,"%lg",&junk);
-          proposal[i]->size++;
-        }
-        rewind(fptr);
-        proposal[i]->size--;
-        proposal[i]->vector = malloc(proposal[i]->size * sizeof(double));
-        proposal[i]->matrix = malloc(data->NP * sizeof(double*));
-        for(int j=0; j<data->NP; j++) proposal[i]->matrix[j] = malloc(proposal[i]->size * sizeof(double));
-        
-        struct Model *temp = malloc(sizeof(struct Model));
-        alloc_model(temp,NMAX,data->N,data->Nchannel, data->NP, data->NT);
-
-        for(int n=0; n<proposal[i]->size; n++)
-        {
-          //fscanf(fptr,"%lg",&junk);
-          scan_source_params(data, temp->source[0], fptr);
-          for(int j=0; j<data->NP; j++) proposal[i]->matrix[j][n] = temp->source[0]->params[j];
-          
-        }
-        free_model(temp);
-        
-        //now sort each row of the matrix
-        for(int j=0; j<data->NP; j++)
-        {
-          //fill up proposal vector
-          for(int n=0; n<proposal[i]->size; n++)
-            proposal[i]->vector[n] = proposal[i]->matrix[j][n];
-
-          //sort it
-          gsl_sort(proposal[i]->vector,1, proposal[i]->size);
-          
-          //replace that row of the matrix
-          for(int n=0; n<proposal[i]->size; n++)
-            proposal[i]->matrix[j][n] = proposal[i]->vector[n];
-        }
-        
-        free(proposal[i]->vector);
-        fclose(fptr);
+        setup_cdf_proposal(data, flags, proposal[i], NMAX);
         break;
         
       default:
@@ -695,21 +867,574 @@ void initialize_proposal(struct Orbit *orbit, struct Data *data, struct Chain *c
     }
   }
   //Fisher proposal fills in the cracks
-  proposal[4]->weight -= check;
+  proposal[PROPOSAL_FISHER]->weight -= check;
   
-  if(proposal[4]->weight<0.0)
+  if(proposal[PROPOSAL_FISHER]->weight<0.0)
   {
     fprintf(stderr,"Proposal weights not normalized (line %d of file %s)\n",__LINE__,__FILE__);
     exit(1);
   }
+  
+  set_proposal_table(proposal, chain->NP);
+}
+
+/*
+ Re-weight the proposals during burn-in by what they cost
+ -each drawn proposal keeps flags->adaptWeights and splits the rest
+  in proportion to moves accepted per CPU second, summed over chains
+ -proposals with zero weight (delayed rejection, multiple try...) stay off
+ -weights are frozen after burn-in, so the sampled chain is Markovian
+ */
+void adapt_proposal_weights(struct Proposal **proposal, int NP, double *accept, double *time, struct Flags *flags)
+{
+  int N = 0;
+  double total = 0.0;
+  double rate[NP+1];
+
+  for(int n=1; n<NP+1; n++)
+  {
+    rate[n] = 0.0;
+    if(!(proposal[n]->weight>0.0)) continue;
+
+    //wait until every proposal has been timed
+    if(!(time[n]>0.0)) return;
+
+    rate[n] = accept[n]/time[n];
+    total  += rate[n];
+    N++;
+  }
+  if(!(total>0.0)) return;
+
+  double share = 1.0 - N*flags->adaptWeights;
+  for(int n=1; n<NP+1; n++)
+    if(proposal[n]->weight>0.0) proposal[n]->weight = flags->adaptWeights + share*rate[n]/total;
+  
+  set_proposal_table(proposal, NP);
 }
 
 
 
+//index of F-statistic grid cell (l,i,j,k), needs n_f, n_theta and n_phi in scope
+#define fstat_cell(l,i,j,k) ((((l)*n_f + (i))*n_theta + (j))*n_phi + (k))
+
+/*
+ F-statistic proposal cache
+ -grids are saved in <cacheDir>/fstat_<key>.dat
+ -key hashes everything the grid depends on: the data and noise,
+  orbit, grid size and F-statistic settings
+ -file is a header followed by the normalized float grid,
+  which is mapped straight into proposal->tensor when read back
+ */
+#define FSTAT_CACHE_VERSION 3
+
+struct FstatCacheHeader
+{
+  char magic[8];
+  int version;
+  int n_fdot;
+  int n_f;
+  int n_theta;
+  int n_phi;
+  unsigned long key;
+  double norm;
+  double maxp;
+};
+
+//64-bit FNV-1a
+static unsigned long hash_bytes(unsigned long hash, const void *ptr, size_t size)
+{
+  const unsigned char *byte = ptr;
+  for(size_t n=0; n<size; n++)
+  {
+    hash ^= byte[n];
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+static unsigned long fstatistic_cache_key(struct Orbit *orbit, struct Data *data, struct Flags *flags, struct Proposal *proposal)
+{
+  unsigned long key = 14695981039346656037UL;
+  
+  //grid settings
+  int version[2] = {FSTAT_CACHE_VERSION, flags->fstatFFT};
+  key = hash_bytes(key, version, sizeof(version));
+  for(int i=0; i<3; i++) key = hash_bytes(key, proposal->matrix[i], 2*sizeof(double));
+  key = hash_bytes(key, proposal->matrix[3], 4*sizeof(double));
+  
+  //data segment
+  int band[2] = {data->N, data->qmin};
+  double time[2] = {data->T, data->t0[0]};
+  key = hash_bytes(key, band, sizeof(band));
+  key = hash_bytes(key, time, sizeof(time));
+  key = hash_bytes(key, data->format, strlen(data->format));
+  key = hash_bytes(key, data->tdi[FIXME]->X, 2*data->N*sizeof(double));
+  key = hash_bytes(key, data->tdi[FIXME]->A, 2*data->N*sizeof(double));
+  key = hash_bytes(key, data->tdi[FIXME]->E, 2*data->N*sizeof(double));
+  
+  //noise model
+  key = hash_bytes(key, data->noise[FIXME]->SnX, data->N*sizeof(double));
+  key = hash_bytes(key, data->noise[FIXME]->SnA, data->N*sizeof(double));
+  key = hash_bytes(key, data->noise[FIXME]->SnE, data->N*sizeof(double));
+  
+  //orbit
+  double arm[2] = {orbit->L, orbit->fstar};
+  key = hash_bytes(key, arm, sizeof(arm));
+  if(flags->orbit)
+  {
+    key = hash_bytes(key, &orbit->Norb, sizeof(int));
+    key = hash_bytes(key, orbit->t, orbit->Norb*sizeof(double));
+    for(int i=0; i<3; i++)
+    {
+      key = hash_bytes(key, orbit->x[i], orbit->Norb*sizeof(double));
+      key = hash_bytes(key, orbit->y[i], orbit->Norb*sizeof(double));
+      key = hash_bytes(key, orbit->z[i], orbit->Norb*sizeof(double));
+    }
+  }
+  
+  return key;
+}
+
+static int load_fstatistic_cache(char *filename, unsigned long key, struct Proposal *proposal)
+{
+  int n_f     = (int)proposal->matrix[0][0];
+  int n_theta = (int)proposal->matrix[1][0];
+  int n_phi   = (int)proposal->matrix[2][0];
+  int n_fdot  = (int)proposal->matrix[3][0];
+  
+  int fd = open(filename, O_RDONLY);
+  if(fd<0) return 0;
+  
+  size_t size = sizeof(struct FstatCacheHeader) + (size_t)n_fdot*n_f*n_theta*n_phi*sizeof(float);
+  struct stat info;
+  if(fstat(fd, &info) || (size_t)info.st_size != size)
+  {
+    close(fd);
+    return 0;
+  }
+  
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map==MAP_FAILED) return 0;
+  
+  struct FstatCacheHeader *header = map;
+  if(strncmp(header->magic,"GBFSTAT",8) || header->version!=FSTAT_CACHE_VERSION || header->key!=key ||
+     header->n_fdot!=n_fdot || header->n_f!=n_f || header->n_theta!=n_theta || header->n_phi!=n_phi)
+  {
+    munmap(map, size);
+    return 0;
+  }
+  
+  //grid is read-only from here on, so it stays in the mapping
+  proposal->norm   = header->norm;
+  proposal->maxp   = header->maxp;
+  proposal->tensor = (float *)(header+1);
+  proposal->size   = n_fdot*n_f*n_theta*n_phi;
+  
+  return 1;
+}
+
+static void save_fstatistic_cache(char *filename, unsigned long key, struct Proposal *proposal)
+{
+  struct FstatCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  sprintf(header.magic,"GBFSTAT");
+  header.version = FSTAT_CACHE_VERSION;
+  header.n_fdot  = (int)proposal->matrix[3][0];
+  header.n_f     = (int)proposal->matrix[0][0];
+  header.n_theta = (int)proposal->matrix[1][0];
+  header.n_phi   = (int)proposal->matrix[2][0];
+  header.key     = key;
+  header.norm    = proposal->norm;
+  header.maxp    = proposal->maxp;
+  
+  //write to a scratch file and rename, so concurrent runs never see a partial grid
+  char tempFile[288];
+  sprintf(tempFile,"%s.%i",filename,(int)getpid());
+  
+  FILE *fptr = fopen(tempFile,"wb");
+  if(fptr==NULL)
+  {
+    fprintf(stderr,"WARNING: could not write F-statistic cache %s\n",tempFile);
+    return;
+  }
+  size_t Ncell = (size_t)header.n_fdot*header.n_f*header.n_theta*header.n_phi;
+  int err = (fwrite(&header, sizeof(header), 1, fptr) != 1);
+  err    += (fwrite(proposal->tensor, sizeof(float), Ncell, fptr) != Ncell);
+  err    += (fclose(fptr) != 0);
+  
+  if(err || rename(tempFile, filename))
+  {
+    fprintf(stderr,"WARNING: could not write F-statistic cache %s\n",filename);
+    remove(tempFile);
+  }
+}
+
+//lower corner and width of grid cell n, in coarse grid units {f,theta,phi,fdot layer}
+static double fstat_cell_bounds(struct Proposal *proposal, int n, double *x)
+{
+  int n_f     = (int)proposal->matrix[0][0];
+  int n_theta = (int)proposal->matrix[1][0];
+  int n_phi   = (int)proposal->matrix[2][0];
+  
+  if(proposal->level)
+  {
+    for(int d=0; d<4; d++) x[d] = proposal->corner[4*n+d];
+    return ldexp(1.0,-proposal->level[n]);
+  }
+  x[0] = (double)((n/(n_theta*n_phi))%n_f);
+  x[1] = (double)((n/n_phi)%n_theta);
+  x[2] = (double)(n%n_phi);
+  x[3] = (double)(n/(n_f*n_theta*n_phi));
+  return 1.0;
+}
+
+/*
+ fdot layers of the grid
+ -layer l is evaluated at a multiple of the fdot resolution d
+ -and covers the part of the fdot prior closer to it than to
+  its neighbours, so the first and last layers are clipped
+ */
+static double fstat_fdot(struct Proposal *proposal, int l)
+{
+  double d = proposal->matrix[3][1];
+  return (round(proposal->matrix[3][2]/d) + (double)l)*d;
+}
+
+//lower edge and width of fdot layer l
+static double fstat_fdot_bounds(struct Proposal *proposal, int l, double *lo)
+{
+  int n_fdot  = (int)proposal->matrix[3][0];
+  double d    = proposal->matrix[3][1];
+  double pmin = proposal->matrix[3][2];
+  double pmax = proposal->matrix[3][3];
+  
+  double a = (l==0)        ? pmin : fstat_fdot(proposal,l) - 0.5*d;
+  double b = (l==n_fdot-1) ? pmax : fstat_fdot(proposal,l) + 0.5*d;
+  *lo = a;
+  return b-a;
+}
+
+//volume of cell n relative to a coarse cell of the average fdot layer
+static double fstat_cell_volume(struct Proposal *proposal, int n)
+{
+  double x[4],lo;
+  double v = fstat_cell_bounds(proposal, n, x);
+  
+  v = v*v*v;
+  
+  int n_fdot = (int)proposal->matrix[3][0];
+  if(n_fdot>1) v *= fstat_fdot_bounds(proposal, (int)x[3], &lo)*n_fdot/(proposal->matrix[3][3]-proposal->matrix[3][2]);
+  
+  return v;
+}
+
+//cells in the first and last frequency row are not F-statistic values
+static int fstat_interior(struct Proposal *proposal, int n)
+{
+  double x[4];
+  fstat_cell_bounds(proposal, n, x);
+  return (x[0] >= 1.0 && x[0] < proposal->matrix[0][0]-1.0);
+}
+
+/*
+ Adaptive refinement of the F-statistic grid
+ -the coarse grid is the first level of a tree stored in proposal->tensor
+ -each pass splits every new leaf within FSTAT_REFINE of the loudest
+  leaf into 2x2x2 children, flags->fstatRefine passes in all
+ -cells are only split in {f,theta,phi}, never across fdot layers
+ -children are evaluated at their lower corners like the coarse cells,
+  so the first child inherits its parent's value
+ */
+//cell index and its logL, to rank split candidates
+struct FstatLeaf
+{
+  int n;
+  double logL;
+};
+
+static int compare_fstat_leaves(const void *a, const void *b)
+{
+  double x = ((const struct FstatLeaf *)a)->logL;
+  double y = ((const struct FstatLeaf *)b)->logL;
+  return (x<y) - (x>y);
+}
+
+static void refine_fstatistic_grid(struct Orbit *orbit, struct Data *data, struct Flags *flags, struct Proposal *proposal)
+{
+  double d_f     = proposal->matrix[0][1];
+  double d_theta = proposal->matrix[1][1];
+  double d_phi   = proposal->matrix[2][1];
+  
+  //coarse cells are the roots of the tree
+  int Nnode = proposal->size;
+  double *corner = malloc(4*Nnode*sizeof(double));
+  for(int n=0; n<Nnode; n++) fstat_cell_bounds(proposal, n, corner+4*n);
+  
+  proposal->corner = corner;
+  proposal->child  = malloc(Nnode*sizeof(int));
+  proposal->level  = malloc(Nnode*sizeof(int));
+  for(int n=0; n<Nnode; n++)
+  {
+    proposal->child[n] = -1;
+    proposal->level[n] = 0;
+  }
+  
+  int first = 0;
+  for(int l=0; l<flags->fstatRefine; l++)
+  {
+    //loudest leaf so far
+    double maxLogL = 0.0;
+    for(int n=0; n<Nnode; n++)
+      if(proposal->child[n]<0 && fstat_interior(proposal,n) && proposal->tensor[n]>maxLogL) maxLogL = proposal->tensor[n];
+    
+    //newest leaves loud enough to split, loudest FSTAT_REFINE_CELLS of them
+    int Nsplit = 0;
+    struct FstatLeaf *leaf = malloc((Nnode-first)*sizeof(struct FstatLeaf));
+    for(int n=first; n<Nnode; n++)
+    {
+      if(fstat_interior(proposal,n) && proposal->tensor[n] >= (1.0-FSTAT_REFINE)*maxLogL)
+      {
+        leaf[Nsplit].n    = n;
+        leaf[Nsplit].logL = proposal->tensor[n];
+        Nsplit++;
+      }
+    }
+    if(Nsplit > FSTAT_REFINE_CELLS)
+    {
+      qsort(leaf, Nsplit, sizeof(struct FstatLeaf), compare_fstat_leaves);
+      Nsplit = FSTAT_REFINE_CELLS;
+    }
+    
+    int *split = malloc(Nsplit*sizeof(int));
+    for(int s=0; s<Nsplit; s++) split[s] = leaf[s].n;
+    free(leaf);
+    
+    if(Nsplit==0)
+    {
+      free(split);
+      break;
+    }
+    
+    int Nnew = Nnode + 8*Nsplit;
+    proposal->tensor = realloc(proposal->tensor, Nnew*sizeof(float));
+    proposal->child  = realloc(proposal->child,  Nnew*sizeof(int));
+    proposal->level  = realloc(proposal->level,  Nnew*sizeof(int));
+    proposal->corner = realloc(proposal->corner, 4*Nnew*sizeof(double));
+    
+    for(int s=0; s<Nsplit; s++)
+    {
+      int n = split[s];
+      double h = ldexp(1.0,-(proposal->level[n]+1));
+      proposal->child[n] = Nnode + 8*s;
+      for(int b=0; b<8; b++)
+      {
+        int m = Nnode + 8*s + b;
+        proposal->child[m] = -1;
+        proposal->level[m] = proposal->level[n]+1;
+        proposal->corner[4*m]   = proposal->corner[4*n]   + h*(double)((b>>2)&1);
+        proposal->corner[4*m+1] = proposal->corner[4*n+1] + h*(double)((b>>1)&1);
+        proposal->corner[4*m+2] = proposal->corner[4*n+2] + h*(double)(b&1);
+        proposal->corner[4*m+3] = proposal->corner[4*n+3];
+      }
+    }
+    
+    #pragma omp parallel num_threads(flags->threads)
+    {
+      //one F-statistic context per thread
+      struct Filter *F_filter = setup_Fstat_filter(FSTAT_BW);
+
+      #pragma omp for schedule(dynamic)
+      for(int m=Nnode; m<Nnew; m++)
+      {
+        if((m-Nnode)%8==0)
+        {
+          proposal->tensor[m] = proposal->tensor[split[(m-Nnode)/8]];
+          continue;
+        }
+      
+        double logL_X,logL_AE;
+        double Fparams[4];
+      
+        double f     = ((double)(data->qmin) + proposal->corner[4*m]*d_f)/data->T;
+        double theta = acos(-1*(-1. + proposal->corner[4*m+1]*d_theta));
+        double phi   = PI2 - proposal->corner[4*m+2]*d_phi;
+        double fdot  = fstat_fdot(proposal, (int)proposal->corner[4*m+3])/(data->T*data->T);
+      
+        get_Fstat_logL(orbit, data, F_filter, f, fdot, theta, phi, &logL_X, &logL_AE, Fparams);
+      
+        proposal->tensor[m] = logL_AE;
+      }
+
+      free_Filter(F_filter);
+    }
+    
+    fprintf(stdout,"   refine  = level %i, %i cells\n",l+1,Nsplit);
+    
+    free(split);
+    first = Nnode;
+    Nnode = Nnew;
+  }
+  
+  proposal->size = Nnode;
+}
+
+static void fill_fstatistic_grid(struct Orbit *orbit, struct Data *data, struct Flags *flags, struct Proposal *proposal)
+{
+  int n_f     = (int)proposal->matrix[0][0];
+  int n_theta = (int)proposal->matrix[1][0];
+  int n_phi   = (int)proposal->matrix[2][0];
+  int n_fdot  = (int)proposal->matrix[3][0];
+  
+  double d_f     = proposal->matrix[0][1];
+  double d_theta = proposal->matrix[1][1];
+  double d_phi   = proposal->matrix[2][1];
+  
+  /*
+   proposal->tensor holds the proposal density
+   - n_fdot x n_f x n_theta x n_phi "tensor" stored contiguously
+   - cell (l,i,j,k) is at fstat_cell(l,i,j,k)
+   */
+  int Ncell = n_fdot*n_f*n_theta*n_phi;
+  proposal->tensor = malloc(Ncell*sizeof(float));
+  for(int n=0; n<Ncell; n++) proposal->tensor[n] = 1.0;
+  
+  if(n_fdot>1) fprintf(stdout,"   fdot    = [%g,%g]\n",fstat_fdot(proposal,0)/(data->T*data->T),fstat_fdot(proposal,n_fdot-1)/(data->T*data->T));
+  
+  for(int l=0; l<n_fdot; l++)
+  {
+    double fdot = fstat_fdot(proposal,l)/(data->T*data->T);
+    
+    /*
+     chirping layers always use the FFT engine (one kernel
+     across the band unless --fstat-fft says otherwise) so
+     each extra layer costs a fraction of the exact one
+     */
+    int span = flags->fstatFFT;
+    if(span==0 && fdot!=0.0) span = data->N;
+    
+    if(span)
+    {
+      /*
+       FFT engine gets every sub-bin of a sky location at once,
+       so sky locations are shared out over the threads instead.
+       */
+      struct FstatFFT *fft = setup_Fstat_fft(data);
+      int nsub  = n_f/data->N;
+      int cells = 0;
+      #pragma omp parallel for collapse(2) schedule(dynamic) num_threads(flags->threads)
+      for (int j=0; j<n_theta; j++)
+      {
+        for(int k=0; k<n_phi; k++)
+        {
+          double theta = acos(-1*(-1. + (double)j*d_theta));
+          double phi = PI2 - (double)k*d_phi;
+          
+          double *logL_X  = malloc(n_f*sizeof(double));
+          double *logL_AE = malloc(n_f*sizeof(double));
+          
+          get_Fstat_logL_fft(orbit, data, fft, fdot, theta, phi, nsub, span, logL_X, logL_AE);
+          
+          for(int i=1; i<n_f-1; i++) proposal->tensor[fstat_cell(l,i,j,k)] = logL_AE[i];
+          
+          free(logL_X);
+          free(logL_AE);
+          
+          int done;
+          #pragma omp atomic capture
+          done = ++cells;
+          if(done%n_phi==0)
+          {
+            #pragma omp critical
+            printProgress(((double)l + (double)done/(double)(n_theta*n_phi))/(double)n_fdot);
+          }
+        }
+      }
+      free_Fstat_fft(fft);
+    }
+    else
+    {
+      /*
+       F-statistic of each interior sub-bin is independent,
+       so frequency rows are shared out over the threads.
+       Every thread works in its own F-statistic context and Fparams
+       and each cell is written to its own slot of the tensor.
+       */
+      int rows = 0;
+      #pragma omp parallel num_threads(flags->threads)
+      {
+        //one F-statistic context per thread
+        struct Filter *F_filter = setup_Fstat_filter(FSTAT_BW);
+        
+        #pragma omp for schedule(dynamic)
+        for(int i=1; i<n_f-1; i++)
+        {
+          //F-statistic for TDI variables and maximized extrinsic parameters
+          double logL_X,logL_AE;
+          double Fparams[4];
+          
+          double q = (double)(data->qmin) + (double)(i)*d_f;
+          double f = q/data->T;
+          
+          //loop over colatitude bins
+          for (int j=0; j<n_theta; j++)
+          {
+            double theta = acos(-1*(-1. + (double)j*d_theta));
+            
+            //loop over longitude bins
+            for(int k=0; k<n_phi; k++)
+            {
+              double phi = PI2 - (double)k*d_phi;
+              
+              get_Fstat_logL(orbit, data, F_filter, f, fdot, theta, phi, &logL_X, &logL_AE, Fparams);
+              
+              proposal->tensor[fstat_cell(l,i,j,k)] = logL_AE;//sqrt(2*logL_AE);
+              
+            }//end loop over longitude bins
+          }//end loop over colatitude bins
+          
+          int done;
+          #pragma omp atomic capture
+          done = ++rows;
+          if(done%(n_f/100)==0)
+          {
+            #pragma omp critical
+            printProgress(((double)l + (double)done/(double)n_f)/(double)n_fdot);
+          }
+        }//end loop over sub-bins
+        
+        free_Filter(F_filter);
+      }
+    }
+  }//end loop over fdot layers
+  
+  proposal->size = Ncell;
+  if(flags->fstatRefine) refine_fstatistic_grid(orbit, data, flags, proposal);
+  
+  //reduce in grid order so the normalization does not depend on the thread count
+  double norm = 0.0;
+  double maxLogL = -1e60;
+  for(int n=0; n<proposal->size; n++)
+  {
+    if(proposal->child && proposal->child[n]>=0) continue;
+    
+    double p = proposal->tensor[n];
+    if(fstat_interior(proposal,n) && p > maxLogL) maxLogL = p;
+    norm += p*fstat_cell_volume(proposal,n);
+  }
+  
+  //normalize
+  proposal->norm = (n_fdot*n_f*n_theta*n_phi)/norm;
+  proposal->maxp = maxLogL*proposal->norm;//sqrt(2.*maxLogL)*proposal->norm;
+  
+  for(int n=0; n<proposal->size; n++) proposal->tensor[n] *= proposal->norm;
+}
+
 void setup_fstatistic_proposal(struct Orbit *orbit, struct Data *data, struct Flags *flags, struct Proposal *proposal)
 {
   /*
-   -Step through 3D grid in frequency and sky location.
+   -Step through 4D grid in fdot, frequency and sky location.
+   - fdot resolution is one frequency bin over the observation
    - frequency resolution hard-coded to 1/4 of a bin
    - sky location resolution hard-coded to 30x30 bins
    -Compute F-statistic in each cell of the grid
@@ -717,9 +1442,6 @@ void setup_fstatistic_proposal(struct Orbit *orbit, struct Data *data, struct Fl
    - normalize to make it a proper proposal (this part is a pain to get right...)
    */
   
-  //matrix to hold maximized extrinsic parameters
-  double *Fparams = malloc(3*sizeof(double));
-  
   //grid sizes
   int n_f     = 4*data->N;
   int n_theta = 30;
@@ -734,27 +1456,52 @@ void setup_fstatistic_proposal(struct Orbit *orbit, struct Data *data, struct Fl
   double d_f     = (double)data->N/(double)n_f;
   double d_theta = 2./(double)n_theta;
   double d_phi   = PI2/(double)n_phi;
+  
+  /*
+   fdot layers span the fdot prior (in params[7] units, so one bin drift is 1)
+   -an fdot offset x costs the F-statistic a mismatch of about pi^2 x^2/45,
+    so layers d apart lose at most FSTAT_FDOT_MISMATCH halfway between them
+   -wide priors (fast chirps) are capped at FSTAT_FDOT_LAYERS coarser layers,
+    since each layer is a full pass over the sky
+   */
+  int n_fdot = 1;
+  double d_fdot = 1.0;
+  double fdotmin = 0.0;
+  double fdotmax = 0.0;
+  if(data->NP>7)
+  {
+    set_fdot_prior(flags, data->qmin/data->T, data->qmax/data->T, data->T, &fdotmin, &fdotmax);
+    fdotmin *= data->T*data->T;
+    fdotmax *= data->T*data->T;
+    
+    d_fdot = 2.0*sqrt(45.*FSTAT_FDOT_MISMATCH)/M_PI;
+    if((fdotmax-fdotmin)/d_fdot + 2 > FSTAT_FDOT_LAYERS) d_fdot = (fdotmax-fdotmin)/(double)(FSTAT_FDOT_LAYERS-2);
+    n_fdot = (int)(round(fdotmax/d_fdot) - round(fdotmin/d_fdot)) + 1;
+  }
 
   fprintf(stdout,"\n============ F-Statistic sky proposal ============\n");
+  fprintf(stdout,"   n_fdot  = %i\n",n_fdot);
+  if(n_fdot>1) fprintf(stdout,"   d_fdot  = %g (bins drifted over T)\n",d_fdot);
   fprintf(stdout,"   n_f     = %i\n",n_f);
   fprintf(stdout,"   n_theta = %i\n",n_theta);
   fprintf(stdout,"   n_phi   = %i\n",n_phi);
   fprintf(stdout,"   cap     = %g\n",SNRCAP);
 
-  double fdot = 0.0; //TODO: what to do about fdot...
-  
-  //F-statistic for TDI variabls
-  double logL_X,logL_AE;
-  
   //allocate memory in proposal structure and pack up metadata
   /*
-   proposal->matrix is 3x2 matrix.
+   proposal->matrix is 3x2 matrix plus an fdot row.
    -rows are parameters {f,theta,phi}
    -columns are bin number and width {n,d}
+   -fdot row is {n,d,min,max}
    */
-  proposal->matrix = malloc(3*sizeof(double *));
+  proposal->matrix = malloc(4*sizeof(double *));
   for(int i=0; i<3; i++)
     proposal->matrix[i] = malloc(2*sizeof(double));
+  proposal->matrix[3] = malloc(4*sizeof(double));
+  
+  proposal->child  = NULL;
+  proposal->level  = NULL;
+  proposal->corner = NULL;
 
   proposal->matrix[0][0] = (double)n_f;
   proposal->matrix[0][1] = d_f;
@@ -764,68 +1511,47 @@ void setup_fstatistic_proposal(struct Orbit *orbit, struct Data *data, struct Fl
   
   proposal->matrix[2][0] = (double)n_phi;
   proposal->matrix[2][1] = d_phi;
+  
+  proposal->matrix[3][0] = (double)n_fdot;
+  proposal->matrix[3][1] = d_fdot;
+  proposal->matrix[3][2] = fdotmin;
+  proposal->matrix[3][3] = fdotmax;
 
+  int Ncell;
+  
   /*
-   proposal->tensor holds the proposal density
-   - n_f x n_theta x n_phi "tensor"
+   reuse the grid of an earlier run on the same data if there is one
+   (refined grids are not cached)
    */
-  proposal->tensor = malloc(n_f*sizeof(double **));
-  for(int i=0; i<n_f; i++)
+  if(flags->cacheDir[0]!='\0' && !flags->fstatRefine)
   {
-    proposal->tensor[i] = malloc(n_theta*sizeof(double *));
-    for(int j=0; j<n_theta; j++)
+    mkdir(flags->cacheDir,S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    unsigned long key = fstatistic_cache_key(orbit, data, flags, proposal);
+    char cacheFile[256];
+    sprintf(cacheFile,"%s/fstat_%016lx.dat",flags->cacheDir,key);
+    if(load_fstatistic_cache(cacheFile, key, proposal))
+      fprintf(stdout,"   cached  = %s\n",cacheFile);
+    else
     {
-      proposal->tensor[i][j] = malloc(n_phi*sizeof(double));
-      for(int k=0; k<n_phi; k++)
-      {
-        proposal->tensor[i][j][k] = 1.0;
-      }
+      fill_fstatistic_grid(orbit, data, flags, proposal);
+      save_fstatistic_cache(cacheFile, key, proposal);
     }
   }
+  else fill_fstatistic_grid(orbit, data, flags, proposal);
   
-  double norm = 0.0;
-  double maxLogL = -1e60;
-  
-  //loop over sub-bins
-  for(int i=0; i<n_f; i++)
+  //alias table over the cells for constant-cost draws
+  //cells are weighted by their volume, and split cells are never drawn
+  Ncell = proposal->size;
+  double *weight = malloc(Ncell*sizeof(double));
+  for(int n=0; n<Ncell; n++)
   {
-    if(i%(n_f/100)==0)printProgress((double)i/(double)n_f);
-
-    double q = (double)(data->qmin) + (double)(i)*d_f;
-    double f = q/data->T;
-    
-    
-    //loop over colatitude bins
-    for (int j=0; j<n_theta; j++)
-    {
-      double theta = acos(-1*(-1. + (double)j*d_theta));
-      
-      //loop over longitude bins
-      for(int k=0; k<n_phi; k++)
-      {
-        double phi = PI2 - (double)k*d_phi;
-        
-        if(i>0 && i<n_f-1)
-        {
-          get_Fstat_logL(orbit, data, f, fdot, theta, phi, &logL_X, &logL_AE, Fparams);
-                    
-          if(logL_AE > maxLogL) maxLogL = logL_AE;
-          //if(logL_AE > SNRCAP)  logL_AE = SNRCAP;
-          
-          proposal->tensor[i][j][k] = logL_AE;//sqrt(2*logL_AE);
-        }
-
-        norm += proposal->tensor[i][j][k];
-        
-      }//end loop over longitude bins
-    }//end loop over colatitude bins
-  }//end loop over sub-bins
-  
-  //normalize
-  proposal->norm = (n_f*n_theta*n_phi)/norm;
-  proposal->maxp = maxLogL*proposal->norm;//sqrt(2.*maxLogL)*proposal->norm;
-  
-  for(int i=0; i<n_f; i++) for(int j=0; j<n_theta; j++) for(int k=0; k<n_phi; k++) proposal->tensor[i][j][k] *= proposal->norm;
+    if(proposal->child && proposal->child[n]>=0)
+      weight[n] = 0.0;
+    else
+      weight[n] = proposal->tensor[n]*fstat_cell_volume(proposal,n);
+  }
+  proposal->alias = setup_alias_table(weight, Ncell);
+  free(weight);
   
   if(flags->verbose)
   {
@@ -843,8 +1569,12 @@ void setup_fstatistic_proposal(struct Orbit *orbit, struct Data *data, struct Fl
         for(int k=0; k<n_phi; k++)
         {
           double phi = (double)k*d_phi;
+          
+          //loudest fdot layer
+          float p = proposal->tensor[fstat_cell(0,i,j,k)];
+          for(int l=1; l<n_fdot; l++) if(proposal->tensor[fstat_cell(l,i,j,k)] > p) p = proposal->tensor[fstat_cell(l,i,j,k)];
 
-          fprintf(fptr,"%.12g %.12g %.12g\n", cos(theta), phi, proposal->tensor[i][j][k]);
+          fprintf(fptr,"%.12g %.12g %.12g\n", cos(theta), phi, p);
         }
         fprintf(fptr,"\n");
       }
@@ -853,27 +1583,37 @@ void setup_fstatistic_proposal(struct Orbit *orbit, struct Data *data, struct Fl
     write_Fstat_animation(data->qmin/data->T, data->T,proposal);
   }
   
-  free(Fparams);
   fprintf(stdout,"\n================================================\n\n");
   fflush(stdout);
 }
 
+//fdot layer nearest to params[7] value fdot
+static int fstat_fdot_layer(struct Proposal *proposal, double fdot)
+{
+  int n_fdot = (int)proposal->matrix[3][0];
+  double d   = proposal->matrix[3][1];
+  int l = (int)(round(fdot/d) - round(proposal->matrix[3][2]/d));
+  if(l<0) l = 0;
+  if(l>n_fdot-1) l = n_fdot-1;
+  return l;
+}
+
+//uniform fdot within layer l
+static void draw_fstatistic_fdot(struct Proposal *proposal, int l, double *params, gsl_rng *seed)
+{
+  double lo;
+  double w = fstat_fdot_bounds(proposal, l, &lo);
+  params[7] = lo + w*gsl_rng_uniform(seed);
+}
+
 double draw_from_fstatistic(struct Data *data, UNUSED struct Model *model, UNUSED struct Source *source, struct Proposal *proposal, double *params, gsl_rng *seed)
 {
   double logP = 0.0;
   
-  int n_f     = (int)proposal->matrix[0][0];
-  int n_theta = (int)proposal->matrix[1][0];
-  int n_phi   = (int)proposal->matrix[2][0];
-  
   double d_f     = proposal->matrix[0][1];
   double d_theta = proposal->matrix[1][1];
   double d_phi   = proposal->matrix[2][1];
 
-  double q,costheta,phi,p,alpha;
-
-  double i,j,k;
-  
   //first draw from prior
   for(int n=0; n<source->NP; n++)
   {
@@ -883,32 +1623,17 @@ double draw_from_fstatistic(struct Data *data, UNUSED struct Model *model, UNUSE
   //put back 
   
   
-  //now rejection sample on f,theta,phi
-  int check=1;
-  while(check)
-  {
-    i = gsl_rng_uniform(seed)*n_f;
-    j = gsl_rng_uniform(seed)*n_theta;
-    k = gsl_rng_uniform(seed)*n_phi;
-    
-    q        = (double)(data->qmin) + i*d_f;
-    costheta = -1. + j*d_theta;
-    phi      = k*d_phi;
-    
-    //printf("q=%g, costheta=%g, phi=%g --> i=%i, j=%i, k=%i\n",q,costheta,phi,(int)i,(int)j,(int)k);
-    
-    p = proposal->tensor[(int)i][(int)j][(int)k];
-    alpha = gsl_rng_uniform(seed)*proposal->maxp;
-    
-    if(p>alpha)check=0;
-
-  }
+  //now draw a cell on f,theta,phi,fdot from the alias table, and a point within it
+  double x[4];
+  int n = draw_from_alias_table(proposal->alias, seed);
+  double h = fstat_cell_bounds(proposal, n, x);
   
-  params[0] = q;
-  params[1] = costheta;
-  params[2] = phi;
+  params[0] = (double)(data->qmin) + (x[0] + h*gsl_rng_uniform(seed))*d_f;
+  params[1] = -1. + (x[1] + h*gsl_rng_uniform(seed))*d_theta;
+  params[2] = (x[2] + h*gsl_rng_uniform(seed))*d_phi;
+  if(proposal->matrix[3][0]>1) draw_fstatistic_fdot(proposal, (int)x[3], params, seed);
   
-  logP += log(p);
+  logP += log(proposal->tensor[n]);
   
   return logP;
 }
@@ -925,9 +1650,10 @@ double jump_from_fstatistic(struct Data *data, struct Model *model, struct Sourc
   double d_theta = proposal->matrix[1][1];
   double d_phi   = proposal->matrix[2][1];
   
-  double q,costheta,phi,p,alpha;
-  
-  double i=0,j,k;
+  int n;
+  double h;
+  double x[4];
+  double i,j,k;
   
   /* half the time do an fm shift, half the time completely rebott frequency */
   int fmFlag = 0;
@@ -937,53 +1663,52 @@ double jump_from_fstatistic(struct Data *data, struct Model *model, struct Sourc
   {
     fm_shift(data, model, source, proposal, params, seed);
     
-    q = params[0];
+    double q = params[0];
     i = floor((q-data->qmin)/d_f);
     
     if(i<0.0 || i>n_f-1) return -INFINITY;
+    
+    //draw a sky cell from frequency row i of the shifted fdot's layer
+    int l = (proposal->matrix[3][0]>1) ? fstat_fdot_layer(proposal, params[7]) : 0;
+    int Nsky = n_theta*n_phi;
+    float *row = proposal->tensor + fstat_cell(l,(int)i,0,0);
+    double sum = 0.0;
+    for(int m=0; m<Nsky; m++) sum += row[m];
+    double u = gsl_rng_uniform(seed)*sum;
+    int m = 0;
+    while(m<Nsky-1 && (u -= row[m]) > 0.0) m++;
+    n = fstat_cell(l,(int)i,0,0) + m;
+    h = fstat_cell_bounds(proposal, n, x);
   }
-  
-  //now rejection sample on f,theta,phi
-  int check=1;
-  while(check)
+  else
   {
-    if(!fmFlag)i = gsl_rng_uniform(seed)*n_f;
-    j = gsl_rng_uniform(seed)*n_theta;
-    k = gsl_rng_uniform(seed)*n_phi;
-    
-    q        = (double)(data->qmin) + i*d_f;
-    costheta = -1. + j*d_theta;
-    phi      = k*d_phi;
-    
-    //printf("q=%g, costheta=%g, phi=%g --> i=%i, j=%i, k=%i\n",q,costheta,phi,(int)i,(int)j,(int)k);
-    if(
-       ((int)i < 0 || (int)i > n_f-1)     ||
-       ((int)j < 0 || (int)j > n_theta-1) ||
-       ((int)k < 0 || (int)k > n_phi-1)
-       )
-    {
-      fprintf(stdout,"%i (%i) %i (%i) %i (%i)\n",(int)i,n_f,(int)j,n_theta,(int)k,n_phi);
-      fflush(stdout);
-      return -INFINITY;
-    }
-    else
-      p = proposal->tensor[(int)i][(int)j][(int)k];
-    alpha = gsl_rng_uniform(seed)*proposal->maxp;
-    
-    if(p>alpha)check=0;
-    
+    //draw a cell on f,theta,phi from the alias table, and a point within it
+    n = draw_from_alias_table(proposal->alias, seed);
+    h = fstat_cell_bounds(proposal, n, x);
+    i = x[0] + h*gsl_rng_uniform(seed);
   }
+  j = x[1] + h*gsl_rng_uniform(seed);
+  k = x[2] + h*gsl_rng_uniform(seed);
   
-  params[0] = q;
-  params[1] = costheta;
-  params[2] = phi;
+  params[0] = (double)(data->qmin) + i*d_f;
+  params[1] = -1. + j*d_theta;
+  params[2] = k*d_phi;
+  if(!fmFlag && proposal->matrix[3][0]>1) draw_fstatistic_fdot(proposal, (int)x[3], params, seed);
   
-  logP = log(p);
+  //a coarse cell drawn by row may have been refined
+  if(fmFlag) logP = evaluate_fstatistic_proposal(data, proposal, params);
+  else       logP = log(proposal->tensor[n]);
   
   return logP;
 }
 
 
+//density callback of the F-statistic jump (the other parameters stay put)
+double fstatistic_density(struct Data *data, UNUSED struct Model *model, UNUSED struct Source *source, struct Proposal *proposal, double *params)
+{
+  return evaluate_fstatistic_proposal(data, proposal, params);
+}
+
 double evaluate_fstatistic_proposal(struct Data *data, struct Proposal *proposal, double *params)
 {  
   double d_f     = proposal->matrix[0][1];
@@ -993,6 +1718,7 @@ double evaluate_fstatistic_proposal(struct Data *data, struct Proposal *proposal
   int n_f     = (int)proposal->matrix[0][0];
   int n_theta = (int)proposal->matrix[1][0];
   int n_phi   = (int)proposal->matrix[2][0];
+  int n_fdot  = (int)proposal->matrix[3][0];
 
   int i = (int)floor((params[0] - data->qmin)/d_f);
   int j = (int)floor((params[1] - -1)/d_theta);
@@ -1001,7 +1727,32 @@ double evaluate_fstatistic_proposal(struct Data *data, struct Proposal *proposal
   if      (i<0 || i>=n_f    ) return -INFINITY;
   else if (j<0 || j>=n_theta) return -INFINITY;
   else if (k<0 || k>=n_phi  ) return -INFINITY;
-  else return log(proposal->tensor[i][j][k]);
+  
+  //fdot layer
+  int l = 0;
+  if(n_fdot>1)
+  {
+    if(params[7]<proposal->matrix[3][2] || params[7]>proposal->matrix[3][3]) return -INFINITY;
+    l = fstat_fdot_layer(proposal, params[7]);
+  }
+  
+  //descend to the refined cell containing params
+  int n = fstat_cell(l,i,j,k);
+  if(proposal->child)
+  {
+    double x[3];
+    x[0] = (params[0] - data->qmin)/d_f;
+    x[1] = (params[1] - -1)/d_theta;
+    x[2] = (params[2])/d_phi;
+    while(proposal->child[n]>=0)
+    {
+      double h = ldexp(1.0,-(proposal->level[n]+1));
+      int b = 0;
+      for(int d=0; d<3; d++) b = 2*b + (x[d] >= proposal->corner[4*n+d]+h);
+      n = proposal->child[n] + b;
+    }
+  }
+  return log(proposal->tensor[n]);
 }
 
 
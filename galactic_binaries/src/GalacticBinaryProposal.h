@@ -17,24 +17,51 @@
 
 #include <stdio.h>
 
+/*
+ proposal ids, which are also their slots in the proposal array
+ */
+enum ProposalID
+{
+  PROPOSAL_DR,        /* delayed rejection (called on its own) */
+  PROPOSAL_MTM,       /* multiple try (called on its own) */
+  PROPOSAL_FSTAT,
+  PROPOSAL_EXTRINSIC,
+  PROPOSAL_FISHER,
+  PROPOSAL_FM_SHIFT,
+  PROPOSAL_DE,
+  PROPOSAL_CDF        /* only with --update */
+};
+
 /*
  proposal prototype
- (func*)(struct, struct, struct, double, gsl_rng)
+ draw:    (func*)(struct, struct, struct, double, gsl_rng)
+ density: log density of params, 0 for symmetric jumps
  */
 struct Proposal
 {
-  double (*function)(struct Data*,struct Model*,struct Source*,struct Proposal*,double*,gsl_rng*);
+  int id;
+  double (*draw)(struct Data*,struct Model*,struct Source*,struct Proposal*,double*,gsl_rng*);
+  double (*density)(struct Data*,struct Model*,struct Source*,struct Proposal*,double*);
   int *trial;
   int *accept;
+  double *time;  /* CPU seconds spent in the proposal by each chain */
   char name[128];
   double norm;
-  double maxp;   /* maximum p for rejection sampling */
+  double maxp;   /* maximum p (colour scale of F-statistic plots) */
   double weight; /* between 0 and 1 */
+  double cumulative; /* sum of weights up to and including this one, over their total */
 
   int size;
   double *vector;
   double **matrix;
-  double ***tensor;
+  float *tensor;
+  struct Alias *alias; /* constant-cost draws from tensor */
+  struct GMM *gmm;     /* mixture fit to an earlier run (cdf draw) */
+
+  /* refined tensor cells (NULL when the grid is not refined) */
+  int *child;     /* first of the 2x2x2 children of each cell, -1 for leaves */
+  int *level;     /* times each cell's coarse ancestor was halved */
+  double *corner; /* lower corner of each cell in coarse grid units (f,theta,phi,fdot layer), 4 per cell */
 };
 
 void setup_frequency_proposal(struct Data *data);
@@ -46,13 +73,24 @@ double draw_from_extrinsic_prior(UNUSED struct Data *data, struct Model *model,
 double draw_from_fisher(UNUSED struct Data *data, struct Model *model, struct Source *source, struct Proposal *proposal, double *params, gsl_rng *seed);
 double draw_from_fstatistic(struct Data *data, UNUSED struct Model *model, UNUSED struct Source *source, struct Proposal *proposal, double *params, gsl_rng *seed);
 double draw_from_galaxy_prior(struct Model *model, struct Prior *prior, double *params, gsl_rng *seed);
+double galaxy_prior_density(struct Model *model, struct Prior *prior, double *params);
+void setup_galaxy_prior_proposal(struct Prior *prior);
+double differential_evolution(struct Data *data, struct Model *model, struct Source *source, struct Proposal *proposal, double *params, gsl_rng *seed);
 double draw_from_cdf(UNUSED struct Data *data, struct Model *model, struct Source *source, struct Proposal *proposal, double *params, gsl_rng *seed);
 double fm_shift(struct Data *data, struct Model *model, struct Source *source, struct Proposal *proposal, double *params, gsl_rng *seed);
 double t0_shift(UNUSED struct Data *data, struct Model *model, UNUSED struct Source *source, UNUSED struct Proposal *proposal, UNUSED double *params, gsl_rng *seed);
 
 double draw_calibration_parameters(struct Data *data, struct Model *model, gsl_rng *seed);
 
-double cdf_density(struct Model *model, struct Source *source, struct Proposal *proposal);
+double cdf_density(UNUSED struct Data *data, struct Model *model, struct Source *source, struct Proposal *proposal, double *params);
+double fstatistic_density(struct Data *data, UNUSED struct Model *model, UNUSED struct Source *source, struct Proposal *proposal, double *params);
+double symmetric_density(UNUSED struct Data *data, UNUSED struct Model *model, UNUSED struct Source *source, UNUSED struct Proposal *proposal, UNUSED double *params);
+
+void set_proposal_table(struct Proposal **proposal, int NP);
+int select_proposal(struct Proposal **proposal, int NP, gsl_rng *seed);
+
+//accept[n] and time[n] are proposal n's accepted moves and CPU seconds summed over all chains
+void adapt_proposal_weights(struct Proposal **proposal, int NP, double *accept, double *time, struct Flags *flags);
 
 void initialize_proposal(struct Orbit *orbit, struct Data *data, struct Chain *chain, struct Flags *flags, struct Proposal **proposal, int NMAX);
 
@@ -0,0 +1,120 @@
+//
+//  GalacticBinaryRNG.c
+//  
+//
+//  Counter-based random number streams for the MCMC.
+//
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <gsl/gsl_rng.h>
+
+#include "GalacticBinaryRNG.h"
+
+/* Philox4x32 constants (Salmon et al. 2011) */
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+#define PHILOX_ROUNDS 10
+
+struct PhiloxState
+{
+  uint32_t key[2];
+  uint32_t counter[4]; //{block, iteration, chain|segment, purpose}
+  uint32_t output[4];
+  int next;            //next unused word of output
+};
+
+static void philox_block(struct PhiloxState *state)
+{
+  uint32_t c[4] = {state->counter[0], state->counter[1], state->counter[2], state->counter[3]};
+  uint32_t k[2] = {state->key[0], state->key[1]};
+  
+  for(int n=0; n<PHILOX_ROUNDS; n++)
+  {
+    uint64_t p0 = (uint64_t)PHILOX_M0 * c[0];
+    uint64_t p1 = (uint64_t)PHILOX_M1 * c[2];
+    
+    uint32_t hi0 = (uint32_t)(p0>>32);
+    uint32_t lo0 = (uint32_t)p0;
+    uint32_t hi1 = (uint32_t)(p1>>32);
+    uint32_t lo1 = (uint32_t)p1;
+    
+    c[0] = hi1 ^ c[1] ^ k[0];
+    c[1] = lo1;
+    c[2] = hi0 ^ c[3] ^ k[1];
+    c[3] = lo0;
+    
+    k[0] += PHILOX_W0;
+    k[1] += PHILOX_W1;
+  }
+  
+  for(int n=0; n<4; n++) state->output[n] = c[n];
+  state->next = 0;
+  
+  //advance block counter within the stream
+  state->counter[0]++;
+}
+
+static unsigned long philox_get(void *vstate)
+{
+  struct PhiloxState *state = vstate;
+  if(state->next>3) philox_block(state);
+  return (unsigned long)state->output[state->next++];
+}
+
+static double philox_get_double(void *vstate)
+{
+  //53 bits of randomness from two words
+  uint64_t a = philox_get(vstate)>>5;
+  uint64_t b = philox_get(vstate)>>6;
+  return (double)(a*67108864ULL + b)/9007199254740992.0;
+}
+
+static void philox_set(void *vstate, unsigned long seed)
+{
+  struct PhiloxState *state = vstate;
+  state->key[0] = (uint32_t)(seed & 0xFFFFFFFFUL);
+  state->key[1] = (uint32_t)(((uint64_t)seed>>32) & 0xFFFFFFFFUL);
+  for(int n=0; n<4; n++) state->counter[n] = 0;
+  state->next = 4;
+}
+
+static const gsl_rng_type philox_type =
+{
+  "philox4x32",
+  0xFFFFFFFFUL,
+  0,
+  sizeof(struct PhiloxState),
+  &philox_set,
+  &philox_get,
+  &philox_get_double
+};
+
+const gsl_rng_type *rng_philox = &philox_type;
+
+void set_rng_stream(gsl_rng *r, unsigned long seed, int chain, int segment, int iteration, int purpose)
+{
+  if(r->type != rng_philox)
+  {
+    fprintf(stderr,"set_rng_stream: %s is not a counter-based generator\n",gsl_rng_name(r));
+    exit(1);
+  }
+  
+  struct PhiloxState *state = gsl_rng_state(r);
+  
+  philox_set(state, seed);
+  state->counter[1] = (uint32_t)iteration;
+  state->counter[2] = ((uint32_t)chain<<16) | ((uint32_t)segment & 0xFFFFU);
+  state->counter[3] = (uint32_t)purpose;
+}
+
+gsl_rng *alloc_rng_stream(unsigned long seed, int chain, int segment, int iteration, int purpose)
+{
+  gsl_rng *r = gsl_rng_alloc(rng_philox);
+  set_rng_stream(r, seed, chain, segment, iteration, purpose);
+  return r;
+}
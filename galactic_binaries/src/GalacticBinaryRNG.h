@@ -0,0 +1,39 @@
+//
+//  GalacticBinaryRNG.h
+//  
+//
+//  Counter-based random number streams for the MCMC.
+//
+//
+
+#ifndef GalacticBinaryRNG_h
+#define GalacticBinaryRNG_h
+
+#include <stdio.h>
+
+#include <gsl/gsl_rng.h>
+
+/*
+ Every random draw is made from a stream identified by
+ (seed, chain, segment, iteration, purpose).  The stream is a
+ Philox4x32-10 counter-based generator wrapped as a gsl_rng_type, so
+ the gsl_ran_* distributions work unchanged.  Because the sequence only
+ depends on the stream key, results do not depend on which thread or
+ rank does the work, or in what order.
+ */
+
+/* what a stream is used for */
+#define RNG_INITIALIZE 0 //starting position of chains
+#define RNG_SAMPLER    1 //source, noise and RJ updates of one segment
+#define RNG_DATA       2 //time-segment start time updates
+#define RNG_SWAP       3 //parallel tempering swaps
+#define RNG_INJECTION  4 //simulated source parameters
+#define RNG_NOISE      5 //simulated noise realization
+#define RNG_PRIOR      6 //Monte Carlo integration of galaxy prior
+
+extern const gsl_rng_type *rng_philox;
+
+gsl_rng *alloc_rng_stream(unsigned long seed, int chain, int segment, int iteration, int purpose);
+void set_rng_stream(gsl_rng *r, unsigned long seed, int chain, int segment, int iteration, int purpose);
+
+#endif /* GalacticBinaryRNG_h */
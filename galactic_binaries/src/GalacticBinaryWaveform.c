@@ -182,6 +182,11 @@ void galactic_binary_fisher(struct Orbit *orbit, struct Data *data, struct Sourc
   
   // Calculate eigenvalues and eigenvectors of fisher matrix
   matrix_eigenstuff(source->fisher_matrix, source->fisher_evectr, source->fisher_evalue, NP);
+  
+  // Remember where it was computed
+  for(i=0; i<NP; i++) source->fisher_params[i] = source->params[i];
+  source->fisher_trial  = 0;
+  source->fisher_accept = 0;
 
   free(params_p);
   free(params_m);
@@ -234,7 +239,71 @@ void galactic_binary_alignment(struct Orbit *orbit, struct Data *data, struct So
   source->imax = source->imin + source->BW;  
 }
 
+struct Workspace *alloc_waveform_workspace(int BW)
+{
+  int BW2 = BW*2;
+  struct Workspace *ws = malloc(sizeof(struct Workspace));
+  
+  ws->BW = BW;
+  
+  ws->x = malloc(sizeof(double)*4);
+  ws->y = malloc(sizeof(double)*4);
+  ws->z = malloc(sizeof(double)*4);
+  
+  ws->data12 = malloc(sizeof(double)*(BW2+1));
+  ws->data21 = malloc(sizeof(double)*(BW2+1));
+  ws->data31 = malloc(sizeof(double)*(BW2+1));
+  ws->data13 = malloc(sizeof(double)*(BW2+1));
+  ws->data23 = malloc(sizeof(double)*(BW2+1));
+  ws->data32 = malloc(sizeof(double)*(BW2+1));
+  
+  ws->d = malloc(sizeof(double**)*4);
+  for(int i=0; i<4; i++)
+  {
+    ws->d[i] = malloc(sizeof(double*)*4);
+    for(int j=0; j<4; j++)
+    {
+      ws->d[i][j] = malloc(sizeof(double*)*(BW2+1));
+    }
+  }
+  
+  return ws;
+}
+
+void free_waveform_workspace(struct Workspace *ws)
+{
+  free(ws->x);
+  free(ws->y);
+  free(ws->z);
+  
+  free(ws->data12);
+  free(ws->data21);
+  free(ws->data31);
+  free(ws->data13);
+  free(ws->data23);
+  free(ws->data32);
+  
+  for(int i=0; i<4; i++)
+  {
+    for(int j=0; j<4; j++)
+    {
+      free(ws->d[i][j]);
+    }
+    free(ws->d[i]);
+  }
+  free(ws->d);
+  
+  free(ws);
+}
+
 void galactic_binary(struct Orbit *orbit, char *format, double T, double t0, double *params, int NP, double *X, double *A, double *E, int BW, int NI)
+{
+  struct Workspace *ws = alloc_waveform_workspace(BW);
+  galactic_binary_workspace(orbit, format, T, t0, params, NP, X, A, E, BW, NI, ws);
+  free_waveform_workspace(ws);
+}
+
+void galactic_binary_workspace(struct Orbit *orbit, char *format, double T, double t0, double *params, int NP, double *X, double *A, double *E, int BW, int NI, struct Workspace *ws)
 {
   /*   Indicies   */
   int i,j,n;
@@ -277,28 +346,19 @@ void galactic_binary(struct Orbit *orbit, char *format, double T, double t0, dou
   //Package cij's into proper form for TDI subroutines
   double ***d;
   
-  /*   Allocating Arrays   */
-  x = malloc(sizeof(double)*4);//dvector(1,3);
-  y = malloc(sizeof(double)*4);//dvector(1,3);
-  z = malloc(sizeof(double)*4);//dvector(1,3);
-  
-  data12 = malloc(sizeof(double)*(BW2+1));//dvector(1,BW2);
-  data21 = malloc(sizeof(double)*(BW2+1));//dvector(1,BW2);
-  data31 = malloc(sizeof(double)*(BW2+1));//dvector(1,BW2);
-  data13 = malloc(sizeof(double)*(BW2+1));//dvector(1,BW2);
-  data23 = malloc(sizeof(double)*(BW2+1));//dvector(1,BW2);
-  data32 = malloc(sizeof(double)*(BW2+1));//dvector(1,BW2);
-  
-  //d = d3tensor(1,3,1,3,1,BW2);
-  d = malloc(sizeof(double**)*4);
-  for(i=0; i<4; i++)
-  {
-    d[i] = malloc(sizeof(double*)*4);
-    for(j=0; j<4; j++)
-    {
-      d[i][j] = malloc(sizeof(double*)*(BW2+1));
-    }
-  }
+  /*   Arrays from the workspace   */
+  x = ws->x;
+  y = ws->y;
+  z = ws->z;
+  
+  data12 = ws->data12;
+  data21 = ws->data21;
+  data31 = ws->data31;
+  data13 = ws->data13;
+  data23 = ws->data23;
+  data32 = ws->data32;
+  
+  d = ws->d;
   
   /*   Gravitational Wave source parameters   */
   
@@ -522,35 +582,5 @@ void galactic_binary(struct Orbit *orbit, char *format, double T, double t0, dou
     exit(1);
   }
   
-  /*   Deallocate Arrays   */
-//  free_dvector(x,1,3); free_dvector(y,1,3); free_dvector(z,1,3);
-//  free_dvector(data12,1,BW2); free_dvector(data21,1,BW2); free_dvector(data31,1,BW2);
-//  free_dvector(data13,1,BW2); free_dvector(data23,1,BW2); free_dvector(data32,1,BW2); 
-//  free_d3tensor(d,1,3,1,3,1,BW2);
-  
-  /*   Allocating Arrays   */
-  free(x);
-  free(y);
-  free(z);
-  
-  free(data12);
-  free(data21);
-  free(data31);
-  free(data13);
-  free(data23);
-  free(data32);
-  
-  //d = d3tensor(1,3,1,3,1,BW2);
-  for(i=0; i<4; i++)
-  {
-    for(j=0; j<4; j++)
-    {
-      free(d[i][j]);
-    }
-    free(d[i]);
-  }
-  free(d);
-
-  
   return;
 }
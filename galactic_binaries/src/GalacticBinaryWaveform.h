@@ -11,6 +11,19 @@
 
 #include <stdio.h>
 
+/*
+ scratch arrays for galactic_binary(), so that
+ callers making many waveforms of one bandwidth
+ can allocate them once
+ */
+struct Workspace
+{
+  int BW;
+  double *x, *y, *z;
+  double *data12, *data13, *data21, *data23, *data31, *data32;
+  double ***d;
+};
+
 double galactic_binary_Amp(double Mc, double f0, double D, double T);
 
 double galactic_binary_fdot(double Mc, double f0, double T);
@@ -26,5 +39,9 @@ void galactic_binary_alignment(struct Orbit *orbit, struct Data *data, struct So
 int galactic_binary_bandwidth(double L, double fstar, double f, double fdot, double costheta, double A, double T, int N);
 
 void galactic_binary(struct Orbit *orbit, char *format, double T, double t0, double params[], int NP, double *X, double *A, double *E, int BW, int NI);
+void galactic_binary_workspace(struct Orbit *orbit, char *format, double T, double t0, double params[], int NP, double *X, double *A, double *E, int BW, int NI, struct Workspace *ws);
+
+struct Workspace *alloc_waveform_workspace(int BW);
+void free_waveform_workspace(struct Workspace *ws);
 
 #endif /* GalacticBinaryWaveform_h */
@@ -0,0 +1,637 @@
+/*
+ gb_global: fit a full frequency band with overlapping gb_mcmc windows
+
+ The band [fmin,fmax) is cut into windows of --samples bins.  Each window
+ owns the central N-2*padding bins and shares --padding bins with each
+ neighbour.  All windows run inside one process on an OpenMP task pool,
+ sharing the orbit, the band data and the galaxy prior.  Every --cadence
+ iterations the windows stop and trade edge sources: the cold-chain
+ sources a window owns are subtracted from its neighbours' data, so a
+ source near a window edge is only fitted once.
+
+ Each window writes the usual gb_mcmc output into window_XXXX/.
+ */
+
+/***************************  REQUIRED LIBRARIES  ***************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*************  PROTOTYPE DECLARATIONS FOR INTERNAL FUNCTIONS  **************/
+
+#include "LISA.h"
+#include "Constants.h"
+#include "GalacticBinary.h"
+#include "GalacticBinaryIO.h"
+#include "GalacticBinaryData.h"
+#include "GalacticBinaryPrior.h"
+#include "GalacticBinaryModel.h"
+#include "GalacticBinaryProposal.h"
+#include "GalacticBinaryRNG.h"
+#include "GalacticBinaryWaveform.h"
+#include "GalacticBinaryMCMC.h"
+
+struct Window
+{
+  int id;
+
+  //frequency range owned by this window
+  double fmin;
+  double fmax;
+
+  //sampler state
+  int mcmc;  //current step (negative during burn-in)
+  int cycle; //iterations done so far
+  double cost; //wall time of the last block [s]
+
+  struct Flags *flags;
+  struct Chain *chain;
+  struct Data **data;
+  struct Model ***model;
+  struct Model ***trial;
+  struct Proposal ***proposal;
+
+  //band data before neighbours' sources are removed
+  struct TDI **raw;
+
+  //sources owned by the neighbours that fall inside this window
+  struct Model *edge;
+  int Nedge; //number of edge sources currently subtracted from the data
+};
+
+static int compare_window_cost(const void *a, const void *b)
+{
+  const struct Window *wa = *(struct Window * const *)a;
+  const struct Window *wb = *(struct Window * const *)b;
+
+  if(wa->cost < wb->cost) return  1;
+  if(wa->cost > wb->cost) return -1;
+  return wa->id - wb->id;
+}
+
+static void make_run_directory(char *dirname)
+{
+  char filename[256];
+
+  mode_t process_mask = umask(0);
+  mkdir(dirname,S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+  sprintf(filename,"%s/chains",dirname);
+  mkdir(filename,S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+  sprintf(filename,"%s/data",dirname);
+  mkdir(filename,S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+  umask(process_mask);
+}
+
+/* read bins [qmin,qmin+N) of the full-band data file once for all windows */
+static double *read_band(char *fileName, int qmin, int N)
+{
+  double f, junk;
+  double *band = malloc(4*N*sizeof(double));
+
+  FILE *fptr = fopen(fileName,"r");
+  if(fptr==NULL)
+  {
+    fprintf(stderr,"Could not open data file %s\n",fileName);
+    exit(1);
+  }
+  fprintf(stdout,"Reading %i frequency bins from %s...\n",N,fileName);
+  for(int n=0; n<qmin; n++) fscanf(fptr,"%lg %lg %lg %lg %lg",&f,&junk,&junk,&junk,&junk);
+  for(int n=0; n<N; n++)
+  {
+    if(fscanf(fptr,"%lg %lg %lg %lg %lg",&f,&band[4*n],&band[4*n+1],&band[4*n+2],&band[4*n+3])!=5)
+    {
+      fprintf(stderr,"Data file %s ends before frequency bin %i\n",fileName,qmin+n);
+      exit(1);
+    }
+  }
+  fclose(fptr);
+
+  return band;
+}
+
+static void initialize_window(struct Window *w, int id, int qmin, double *band, int qband, struct Data **data_vec, struct Flags *flags_vec, struct Chain *chain_vec, struct Orbit *orbit, int NMAX, int DMAX)
+{
+  char dirname[128];
+
+  w->id    = id;
+  w->mcmc  = -flags_vec->NBURN;
+  w->cycle = 0;
+  w->cost  = 0.0;
+
+  /* each window gets its own copy of the run flags */
+  w->flags = malloc(sizeof(struct Flags));
+  memcpy(w->flags, flags_vec, sizeof(struct Flags));
+  struct Flags *flags = w->flags;
+
+  //windows run concurrently, so the segment loop inside a window is serial
+  flags->threads = 1;
+
+  /* data segments start padding bins below the owned range */
+  w->data = malloc(flags->NDATA*sizeof(struct Data*));
+  for(int i=0; i<flags->NDATA; i++)
+  {
+    w->data[i] = malloc(sizeof(struct Data));
+    memcpy(w->data[i], data_vec[i], sizeof(struct Data));
+
+    w->data[i]->t0   = malloc(NMAX*sizeof(double));
+    w->data[i]->tgap = malloc(NMAX*sizeof(double));
+    for(int j=0; j<NMAX; j++)
+    {
+      w->data[i]->t0[j]   = data_vec[i]->t0[j];
+      w->data[i]->tgap[j] = data_vec[i]->tgap[j];
+    }
+
+    w->data[i]->qmin  = qmin;
+    w->data[i]->qmax  = qmin + w->data[i]->N;
+    w->data[i]->fmin  = (double)w->data[i]->qmin/w->data[i]->T;
+    w->data[i]->fmax  = (double)w->data[i]->qmax/w->data[i]->T;
+    w->data[i]->cseed = data_vec[i]->cseed + id;
+  }
+  struct Data *data = w->data[0];
+
+  w->fmin = (double)(qmin + flags->padding)/data->T;
+  w->fmax = (double)(qmin + data->N - flags->padding)/data->T;
+
+  /* everything written during setup goes into the window's directory */
+  sprintf(dirname,"window_%04i",id);
+  make_run_directory(dirname);
+  if(chdir(dirname))
+  {
+    fprintf(stderr,"Could not enter run directory %s\n",dirname);
+    exit(1);
+  }
+
+  alloc_data(w->data, flags);
+
+  //copy this window's slice of the band
+  for(int n=0; n<data->N; n++)
+  {
+    int q = qmin + n - qband;
+    data->tdi[0]->A[2*n]   = band[4*q];
+    data->tdi[0]->A[2*n+1] = band[4*q+1];
+    data->tdi[0]->E[2*n]   = band[4*q+2];
+    data->tdi[0]->E[2*n+1] = band[4*q+3];
+  }
+  GalacticBinarySetupData(w->data, orbit, flags);
+  setup_frequency_proposal(data);
+
+  //keep the window data before any edge sources are removed
+  w->raw = malloc(flags->NT*sizeof(struct TDI*));
+  for(int j=0; j<flags->NT; j++)
+  {
+    w->raw[j] = malloc(sizeof(struct TDI));
+    alloc_tdi(w->raw[j], data->N, data->Nchannel);
+    copy_tdi(data->tdi[j], w->raw[j]);
+  }
+
+  /* parallel chain */
+  w->chain = malloc(sizeof(struct Chain));
+  w->chain->NC = chain_vec->NC;
+  w->chain->NP = chain_vec->NP;
+  initialize_chain(w->chain, flags, &data->cseed);
+
+  struct Chain *chain = w->chain;
+  int NC = chain->NC;
+
+  /* proposals */
+  w->proposal = malloc(flags->NDATA*sizeof(struct Proposal**));
+  for(int j=0; j<flags->NDATA; j++)
+  {
+    w->proposal[j] = malloc((chain->NP+1)*sizeof(struct Proposal*));
+    for(int i=0; i<chain->NP+1; i++) w->proposal[j][i] = malloc(sizeof(struct Proposal));
+    initialize_proposal(orbit, w->data[j], chain, flags, w->proposal[j], DMAX);
+  }
+
+  /* models */
+  w->model = malloc(NC*sizeof(struct Model**));
+  w->trial = malloc(NC*sizeof(struct Model**));
+  for(int ic=0; ic<NC; ic++)
+  {
+    w->model[ic] = malloc(flags->NDATA*sizeof(struct Model*));
+    w->trial[ic] = malloc(flags->NDATA*sizeof(struct Model*));
+
+    for(int i=0; i<flags->NDATA; i++)
+    {
+      struct Data *data_ptr = w->data[i];
+
+      w->model[ic][i] = malloc(sizeof(struct Model));
+      w->trial[ic][i] = malloc(sizeof(struct Model));
+      struct Model *model_ptr = w->model[ic][i];
+
+      alloc_model(model_ptr,DMAX,data_ptr->N,data_ptr->Nchannel,data_ptr->NP,flags->NT);
+      alloc_model(w->trial[ic][i],DMAX,data_ptr->N,data_ptr->Nchannel,data_ptr->NP,flags->NT);
+      alloc_history(model_ptr, w->trial[ic][i], HISTORY_SIZE);
+
+      set_rng_stream(chain->r[ic], chain->seed, ic, i, 0, RNG_INITIALIZE);
+
+      set_uniform_prior(flags, model_ptr, data_ptr, 0);
+
+      //set noise model
+      for(int j=0; j<flags->NT; j++) copy_noise(data_ptr->noise[j], model_ptr->noise[j]);
+
+      //set signal model
+      for(int n=0; n<DMAX; n++)
+      {
+        if(flags->update)
+          draw_from_cdf(data_ptr, model_ptr, model_ptr->source[n], w->proposal[i][PROPOSAL_CDF], model_ptr->source[n]->params , chain->r[ic]);
+        else
+          draw_from_prior(data_ptr, model_ptr, model_ptr->source[n], w->proposal[i][0], model_ptr->source[n]->params , chain->r[ic]);
+        map_array_to_params(model_ptr->source[n], model_ptr->source[n]->params, data_ptr->T);
+        galactic_binary_fisher(orbit, data_ptr, model_ptr->source[n], data_ptr->noise[0]);
+      }
+
+      // Form master model & compute likelihood of starting position
+      generate_noise_model(data_ptr, model_ptr);
+      generate_signal_model(orbit, data_ptr, model_ptr, -1);
+
+      //calibration error
+      if(flags->calibration)
+      {
+        draw_calibration_parameters(data_ptr, model_ptr, chain->r[ic]);
+        generate_calibration_model(data_ptr, model_ptr);
+        apply_calibration_model(data_ptr, model_ptr);
+      }
+      if(!flags->prior)
+      {
+        model_ptr->logL     = gaussian_log_likelihood(orbit, data_ptr, model_ptr);
+        model_ptr->logLnorm = gaussian_log_likelihood_constant_norm(data_ptr, model_ptr);
+      }
+      else model_ptr->logL = model_ptr->logLnorm = 0.0;
+
+      if(ic==0) chain->logLmax += model_ptr->logL + model_ptr->logLnorm;
+    }
+  }
+
+  //holder for the neighbours' edge sources
+  w->edge = malloc(sizeof(struct Model));
+  alloc_model(w->edge,DMAX,data->N,data->Nchannel,data->NP,flags->NT);
+  set_uniform_prior(flags, w->edge, data, 0);
+  w->edge->Nlive = 0;
+  w->Nedge = 0;
+
+  if(chdir(".."))
+  {
+    fprintf(stderr,"Could not leave run directory %s\n",dirname);
+    exit(1);
+  }
+}
+
+/* advance one window by up to steps iterations (the gb_mcmc loop without its run control) */
+static void window_mcmc(struct Window *w, struct Orbit *orbit, struct Prior *prior, int Nsteps)
+{
+  struct Flags *flags = w->flags;
+  struct Chain *chain = w->chain;
+  struct Data **data  = w->data;
+  struct Model ***model = w->model;
+  struct Model ***trial = w->trial;
+  struct Proposal ***proposal = w->proposal;
+
+  int NC = chain->NC;
+
+  for(int step=0; step<Nsteps && w->mcmc<flags->NMCMC; step++)
+  {
+    //single rank: every chain belongs to this window
+    int mcmc = mcmc_iteration(orbit, data, model, trial, chain, flags, prior, proposal, w->mcmc, w->cycle, 0, 1);
+
+    //dump waveforms to file, update avgLogL for thermodynamic integration
+    if(mcmc>0 && mcmc%data[FIXME]->downsample==0)
+    {
+      for(int i=0; i<flags->NDATA; i++)save_waveforms(data[i], model[chain->index[0]][i], mcmc/data[i]->downsample);
+      for(int ic=0; ic<NC; ic++)
+      {
+        chain->dimension[ic][model[chain->index[ic]][0]->Nlive]++;
+        for(int i=0; i<flags->NDATA; i++)
+          chain->avgLogL[ic] += model[chain->index[ic]][i]->logL + model[chain->index[ic]][i]->logLnorm;
+      }
+    }
+
+    w->mcmc = mcmc+1;
+    w->cycle++;
+  }
+}
+
+/* collect the neighbours' cold-chain sources that overlap window w */
+static void gather_edge_sources(struct Window **window, int Nwin, int w)
+{
+  struct Model *edge = window[w]->edge;
+  struct Data  *data = window[w]->data[0];
+
+  edge->Nlive = 0;
+
+  for(int v=w-1; v<=w+1; v+=2)
+  {
+    if(v<0 || v>=Nwin) continue;
+
+    struct Window *neighbour = window[v];
+    struct Model *cold = neighbour->model[neighbour->chain->index[0]][0];
+
+    for(int n=0; n<cold->Nlive; n++)
+    {
+      double f0 = cold->source[n]->f0;
+
+      //only sources the neighbour owns, and that land in this window's bins
+      if(f0 <  neighbour->fmin || f0 >= neighbour->fmax) continue;
+      if(f0 <  data->fmin      || f0 >= data->fmax)      continue;
+      if(edge->Nlive == edge->Nmax) break;
+
+      copy_source(cold->source[n], edge->source[edge->Nlive]);
+      edge->Nlive++;
+    }
+  }
+}
+
+/* remove the edge sources from the window data and refresh every chain's likelihood */
+static void subtract_edge_sources(struct Window *w, struct Orbit *orbit)
+{
+  struct Flags *flags = w->flags;
+  struct Chain *chain = w->chain;
+  struct Data  *data  = w->data[0];
+  struct Model *edge  = w->edge;
+
+  int N2 = 2*data->N;
+
+  //nothing to do if the data is, and stays, the raw band
+  if(edge->Nlive==0 && w->Nedge==0) return;
+  w->Nedge = edge->Nlive;
+
+  generate_signal_model(orbit, data, edge, -1);
+
+  for(int j=0; j<flags->NT; j++)
+  {
+    for(int n=0; n<N2; n++)
+    {
+      data->tdi[j]->X[n] = w->raw[j]->X[n] - edge->tdi[j]->X[n];
+      data->tdi[j]->A[n] = w->raw[j]->A[n] - edge->tdi[j]->A[n];
+      data->tdi[j]->E[n] = w->raw[j]->E[n] - edge->tdi[j]->E[n];
+    }
+  }
+
+  if(flags->prior) return;
+
+  for(int ic=0; ic<chain->NC; ic++)
+  {
+    for(int i=0; i<flags->NDATA; i++)
+    {
+      struct Model *model_ptr = w->model[ic][i];
+      model_ptr->logL = gaussian_log_likelihood(orbit, w->data[i], model_ptr);
+    }
+  }
+
+  //the data changed, so restart the maximum from the best current chain
+  chain->logLmax = -INFINITY;
+  for(int ic=0; ic<chain->NC; ic++)
+  {
+    double logL = 0.0;
+    for(int i=0; i<flags->NDATA; i++) logL += w->model[ic][i]->logL + w->model[ic][i]->logLnorm;
+    if(logL > chain->logLmax) chain->logLmax = logL;
+  }
+}
+
+/* ============================  MAIN PROGRAM  ============================ */
+
+int main(int argc, char *argv[])
+{
+  time_t start, stop;
+  start = time(NULL);
+
+  int NMAX = 10;   //max number of frequency & time segments
+  int DMAX = 20;   //max number of GB waveforms
+
+  /* Allocate data structures */
+  struct Flags *flags = malloc(sizeof(struct Flags));
+  struct Orbit *orbit = malloc(sizeof(struct Orbit));
+  struct Chain *chain = malloc(sizeof(struct Chain));
+  struct Data  **data = malloc(sizeof(struct Data*)*NMAX);
+
+  /* Parse command line and set defaults/flags */
+  for(int i=0; i<NMAX; i++)
+  {
+    data[i] = malloc(sizeof(struct Data));
+    data[i]->t0   = malloc( NMAX * sizeof(double) );
+    data[i]->tgap = malloc( NMAX * sizeof(double) );
+  }
+  parse(argc,argv,data,orbit,flags,chain,NMAX,DMAX);
+
+  if(!flags->strainData)
+  {
+    fprintf(stderr,"gb_global fits a band of strain data, use --data\n");
+    return 1;
+  }
+  if(data[0]->fmax <= data[0]->fmin)
+  {
+    fprintf(stderr,"gb_global needs --fmax above --fmin\n");
+    return 1;
+  }
+  if(2*flags->padding >= data[0]->N)
+  {
+    fprintf(stderr,"--padding (%i) must be less than half of --samples (%i)\n",flags->padding,data[0]->N);
+    return 1;
+  }
+  if(flags->resume)
+  {
+    fprintf(stderr,"gb_global cannot --resume, windows are not checkpointed\n");
+    return 1;
+  }
+  if(flags->targetESS)
+  {
+    fprintf(stderr,"gb_global does not support --target-ess, windows run for a fixed number of steps\n");
+    return 1;
+  }
+  if(flags->walltime)
+  {
+    fprintf(stderr,"gb_global does not support --walltime, windows run for a fixed number of steps\n");
+    return 1;
+  }
+  if(flags->cadence < 1)
+  {
+    fprintf(stderr,"--cadence must be at least 1\n");
+    return 1;
+  }
+
+  /* Load spacecraft ephemerides */
+  switch(flags->orbit)
+  {
+    case 0:
+      initialize_analytic_orbit(orbit);
+      break;
+    case 1:
+      initialize_numeric_orbit(orbit);
+      break;
+    default:
+      fprintf(stderr,"unsupported orbit type\n");
+      return(1);
+      break;
+  }
+
+  /* Tile the band with overlapping windows */
+  int N      = data[0]->N;
+  int stride = N - 2*flags->padding;
+  int qstart = (int)(data[0]->fmin*data[0]->T);
+  int qstop  = (int)ceil(data[0]->fmax*data[0]->T);
+  int Nwin   = (qstop - qstart + stride - 1)/stride;
+
+  //data bins needed by all windows
+  int qband = qstart - flags->padding;
+  int Nband = (Nwin-1)*stride + N;
+  if(qband < 0)
+  {
+    fprintf(stderr,"--fmin must leave %i bins of padding above f=0\n",flags->padding);
+    return 1;
+  }
+
+  fprintf(stdout,"\n================ WINDOWS ==================\n");
+  fprintf(stdout,"  Frequency band ...... [%g,%g)\n",(double)qstart/data[0]->T,(double)(qstart+Nwin*stride)/data[0]->T);
+  fprintf(stdout,"  Windows ............. %i\n",Nwin);
+  fprintf(stdout,"  Owned bins .......... %i\n",stride);
+  fprintf(stdout,"  Padding bins ........ %i\n",flags->padding);
+  fprintf(stdout,"  Handoff cadence ..... %i\n",flags->cadence);
+  fprintf(stdout,"  Threads ............. %i\n",flags->threads);
+  fprintf(stdout,"============================================\n");
+
+  double *band = read_band(data[0]->fileName, qband, Nband);
+
+  /* Shared priors */
+  struct Prior *prior = malloc(sizeof(struct Prior));
+  if(flags->galaxyPrior)
+  {
+    set_galaxy_prior(flags, prior);
+    setup_galaxy_prior_proposal(prior);
+  }
+
+  /* Set up windows (serial, each window writes into its own directory) */
+  struct Window **window = malloc(Nwin*sizeof(struct Window*));
+  for(int w=0; w<Nwin; w++)
+  {
+    window[w] = malloc(sizeof(struct Window));
+    initialize_window(window[w], w, qband + w*stride, band, qband, data, flags, chain, orbit, NMAX, DMAX);
+  }
+  free(band);
+
+  /* windows in the order they are handed to the task pool */
+  struct Window **queue = malloc(Nwin*sizeof(struct Window*));
+  for(int w=0; w<Nwin; w++) queue[w] = window[w];
+
+  /* The MCMC loop, in blocks of --cadence iterations */
+  int block = 0;
+  int running = Nwin;
+  while(running)
+  {
+    //start with the most expensive windows so the tail of the block stays short
+    qsort(queue, Nwin, sizeof(struct Window*), compare_window_cost);
+
+    #pragma omp parallel num_threads(flags->threads)
+    {
+      #pragma omp single
+      {
+        for(int k=0; k<Nwin; k++)
+        {
+          struct Window *w = queue[k];
+          if(w->mcmc >= w->flags->NMCMC) continue;
+
+          #pragma omp task firstprivate(w)
+          {
+            double t = wall_time();
+            window_mcmc(w, orbit, prior, flags->cadence);
+            w->cost = wall_time() - t;
+          }
+        }
+      }
+    }
+
+    /* hand edge sources to the neighbouring windows */
+    for(int w=0; w<Nwin; w++) gather_edge_sources(window, Nwin, w);
+    for(int w=0; w<Nwin; w++) subtract_edge_sources(window[w], orbit);
+
+    //make the chain files current before the next block
+    fflush(NULL);
+
+    running = 0;
+    for(int w=0; w<Nwin; w++) if(window[w]->mcmc < window[w]->flags->NMCMC) running++;
+
+    block++;
+    if(flags->verbose)
+    {
+      fprintf(stdout,"block %i: %i/%i windows running\n",block,running,Nwin);
+      for(int w=0; w<Nwin; w++)
+        fprintf(stdout,"  window %4i  step %6i  sources %2i  edge %2i  cost %.2fs\n",w,window[w]->mcmc,window[w]->model[window[w]->chain->index[0]][0]->Nlive,window[w]->edge->Nlive,window[w]->cost);
+    }
+  }
+
+  /* Print per-window run files/results */
+  char dirname[128];
+  for(int w=0; w<Nwin; w++)
+  {
+    struct Window *win = window[w];
+
+    sprintf(dirname,"window_%04i",w);
+    if(chdir(dirname))
+    {
+      fprintf(stderr,"Could not enter run directory %s\n",dirname);
+      return 1;
+    }
+
+    for(int i=0; i<win->flags->NDATA; i++)print_waveforms_reconstruction(win->data[i],i);
+    print_waveform_draw(win->data, win->model[win->chain->index[0]], win->flags);
+
+    FILE *chainFile = fopen("avg_log_likelihood.dat","w");
+    for(int ic=0; ic<win->chain->NC; ic++) fprintf(chainFile,"%lg %lg\n",1./win->chain->temperature[ic],win->chain->avgLogL[ic]/(double)(win->flags->NMCMC/win->data[FIXME]->downsample));
+    fclose(chainFile);
+
+    FILE *zFile = fopen("evidence.dat","w");
+    for(int i=0; i<DMAX; i++) fprintf(zFile,"%i %i\n",i,win->chain->dimension[0][i]);
+    fclose(zFile);
+
+    if(chdir(".."))
+    {
+      fprintf(stderr,"Could not leave run directory %s\n",dirname);
+      return 1;
+    }
+  }
+
+  //summary of the tiling
+  FILE *windowFile = fopen("windows.dat","w");
+  for(int w=0; w<Nwin; w++)
+  {
+    struct Window *win = window[w];
+    fprintf(windowFile,"%i %.12g %.12g %.12g %.12g %i %i\n",w,win->data[0]->fmin,win->data[0]->fmax,win->fmin,win->fmax,win->model[win->chain->index[0]][0]->Nlive,win->edge->Nlive);
+  }
+  fclose(windowFile);
+
+  //print total run time
+  stop = time(NULL);
+
+  if(flags->verbose) printf(" ELAPSED TIME = %g second\n",(double)(stop-start));
+
+  //free memory and exit cleanly
+  for(int w=0; w<Nwin; w++)
+  {
+    struct Window *win = window[w];
+    for(int ic=0; ic<win->chain->NC; ic++)
+    {
+      for(int i=0; i<win->flags->NDATA; i++)
+      {
+        free_history(win->model[ic][i]);
+        free_model(win->model[ic][i]);
+        free_model(win->trial[ic][i]);
+      }
+    }
+    free_model(win->edge);
+    for(int j=0; j<win->flags->NT; j++) free_tdi(win->raw[j]);
+    free_chain(win->chain,win->flags);
+  }
+  if(flags->orbit)free_orbit(orbit);
+
+  return 0;
+}
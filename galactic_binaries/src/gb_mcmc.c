@@ -0,0 +1,560 @@
+
+/***************************  REQUIRED LIBRARIES  ***************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef USE_MPI
+#include <mpi.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*************  PROTOTYPE DECLARATIONS FOR INTERNAL FUNCTIONS  **************/
+
+#include "LISA.h"
+#include "Constants.h"
+#include "BayesLine.h"
+#include "GalacticBinary.h"
+#include "GalacticBinaryIO.h"
+#include "GalacticBinaryData.h"
+#include "GalacticBinaryPrior.h"
+#include "GalacticBinaryModel.h"
+#include "GalacticBinaryProposal.h"
+#include "GalacticBinaryRNG.h"
+#include "GalacticBinaryWaveform.h"
+#include "GalacticBinaryMCMC.h"
+#include "GalacticBinaryConvergence.h"
+#include "GalacticBinaryCheckpoint.h"
+
+
+#ifdef USE_MPI
+void mpi_set_append(FILE *fptr);
+void mpi_append_chain_files(struct Chain *chain, struct Flags *flags);
+void mpi_reduce_waveform_samples(double *samples, int Nwave);
+void mpi_combine_waveforms(struct Data *data);
+#endif
+
+//fraction of --walltime held back for writing the final output
+#define WALLTIME_RESERVE 0.05
+
+static void fit_run_to_walltime(struct Data **data, struct Flags *flags, int N)
+{
+  /*
+   Post burn-in run gets N steps.  The waveform sample buffers are already
+   allocated, so the thinning grows with N to keep the samples in them.
+   */
+  int Nwave = data[0]->Nwave;
+  if(N < 1) N = 1;
+  
+  int downsample = (N + Nwave - 1)/Nwave;
+  
+  flags->NMCMC = N;
+  for(int i=0; i<flags->NDATA; i++) data[i]->downsample = downsample;
+}
+
+/* ============================  MAIN PROGRAM  ============================ */
+
+int main(int argc, char *argv[])
+{
+  
+  int ic;
+  
+  time_t start, stop;
+  start = time(NULL);
+  double run_start = wall_time();
+  
+  /* Model slots are distributed round-robin over MPI ranks */
+  int rank = 0;
+  int size = 1;
+  
+#ifdef USE_MPI
+  int token = 0;
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  
+  //OpenMP threads run the chains, so the master thread must be allowed to make MPI calls
+  if(provided < MPI_THREAD_FUNNELED)
+  {
+    if(rank==0) fprintf(stderr,"MPI library only provides thread level %i, gb_mcmc_mpi needs MPI_THREAD_FUNNELED (%i)\n",provided,MPI_THREAD_FUNNELED);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  
+  //only the root rank reports the run setup
+  int stdout_fd = dup(STDOUT_FILENO);
+  if(rank>0)
+  {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+  }
+  
+  //ranks take turns writing the (identical) setup files
+  if(rank>0) MPI_Recv(&token, 1, MPI_INT, rank-1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+#endif
+  
+  int NMAX = 10;   //max number of frequency & time segments
+  int DMAX = 20;   //100; //max number of GB waveforms
+  
+  /* Allocate data structures */
+  struct Flags *flags = malloc(sizeof(struct Flags));
+  struct Orbit *orbit = malloc(sizeof(struct Orbit));
+  struct Chain *chain = malloc(sizeof(struct Chain));
+  struct Data  **data = malloc(sizeof(struct Data*)*NMAX); //data[NF]
+
+  
+  /* Parse command line and set defaults/flags */
+  for(int i=0; i<NMAX; i++)
+  {
+    data[i] = malloc(sizeof(struct Data));
+    data[i]->t0   = malloc( NMAX * sizeof(double) );
+    data[i]->tgap = malloc( NMAX * sizeof(double) );
+  }
+  parse(argc,argv,data,orbit,flags,chain,NMAX,DMAX);
+  int NC = chain->NC;
+  
+  
+  /* Allocate model structures */
+  struct Model ***trial= malloc(sizeof(struct Model**)*NC); //trial[chain][segment]
+  struct Model ***model= malloc(sizeof(struct Model**)*NC); //model[chain][source][segment]
+  
+  /* Load spacecraft ephemerides */
+  switch(flags->orbit)
+  {
+    case 0:
+      initialize_analytic_orbit(orbit);
+      break;
+    case 1:
+      initialize_numeric_orbit(orbit);
+      break;
+    default:
+      fprintf(stderr,"unsupported orbit type\n");
+      return(1);
+      break;
+  }
+  
+  /* Initialize data structures */
+  alloc_data(data, flags);
+
+  /* Inject strain data */
+  if(flags->strainData)
+  {
+    GalacticBinaryReadData(data,orbit,flags);
+  }
+  else
+  {
+    /* Inject gravitational wave signal */
+    if(flags->knownSource)
+      GalacticBinaryInjectVerificationSource(data,orbit,flags);
+    else
+      GalacticBinaryInjectSimulatedSource(data,orbit,flags);
+  }
+  
+  /* Initialize data-dependent proposal */
+  setup_frequency_proposal(data[0]);
+  
+#ifdef USE_MPI
+  if(rank<size-1) MPI_Send(&token, 1, MPI_INT, rank+1, 0, MPI_COMM_WORLD);
+#endif
+  
+  /* Initialize parallel chain */
+  initialize_chain(chain, flags, &data[0]->cseed);
+  
+  /* Initialize MCMC proposals */
+  printf("chain->NP=%i\n",chain->NP);
+  struct Proposal ***proposal = malloc(NMAX*sizeof(struct Proposal**));
+  for(int j=0; j<NMAX; j++)
+  {
+    proposal[j] = malloc((chain->NP+1)*sizeof(struct Proposal*));
+    for(int i=0; i<chain->NP+1; i++) proposal[j][i] = malloc(sizeof(struct Proposal));
+  
+  }
+  for(int j=0; j<flags->NDATA; j++) initialize_proposal(orbit, data[j], chain, flags, proposal[j], DMAX);
+
+  /* Initialize priors */
+  struct Prior *prior = malloc(sizeof(struct Prior));
+  if(flags->galaxyPrior)
+  {
+    set_galaxy_prior(flags, prior);
+    setup_galaxy_prior_proposal(prior);
+  }
+
+  
+  /* Initialize data models */
+  for(ic=0; ic<NC; ic++)
+  {
+    //printf("initialize model\n");
+
+    trial[ic] = malloc(sizeof(struct Model *) * flags->NDATA);
+    model[ic] = malloc(sizeof(struct Model *) * flags->NDATA);
+    
+    //loop over frequency segments
+    for(int i=0; i<flags->NDATA; i++)
+    {
+      //printf("frequency segment %i\n",i);
+
+      model[ic][i] = malloc(sizeof(struct Model));
+      
+      //each segment gets its own scratch model so segments can be updated concurrently
+      trial[ic][i] = malloc(sizeof(struct Model));
+      alloc_model(trial[ic][i],DMAX,data[i]->N,data[i]->Nchannel,data[i]->NP, data[i]->NT);
+      
+      set_rng_stream(chain->r[ic], chain->seed, ic, i, 0, RNG_INITIALIZE);
+      
+      struct Model *model_ptr = model[ic][i];
+      struct Data  *data_ptr  = data[i];
+      
+      alloc_model(model_ptr,DMAX,data_ptr->N,data_ptr->Nchannel, data_ptr->NP, flags->NT);
+      alloc_history(model_ptr, trial[ic][i], HISTORY_SIZE);
+      
+      if(ic==0)set_uniform_prior(flags, model_ptr, data_ptr, 1);
+      else     set_uniform_prior(flags, model_ptr, data_ptr, 0);
+      
+      //set noise model
+      for(int j=0; j<flags->NT; j++) copy_noise(data_ptr->noise[j], model_ptr->noise[j]);
+      
+      //set signal model
+      for(int n=0; n<DMAX; n++)
+      {
+
+        if(flags->cheat)
+        {
+          struct Source *inj = data_ptr->inj;
+          //map parameters to vector
+          model_ptr->source[n]->NP       = inj->NP;
+          model_ptr->source[n]->f0       = inj->f0;
+          model_ptr->source[n]->dfdt     = inj->dfdt;
+          model_ptr->source[n]->costheta = inj->costheta;
+          model_ptr->source[n]->phi      = inj->phi;
+          model_ptr->source[n]->amp      = inj->amp;
+          model_ptr->source[n]->cosi     = inj->cosi;
+          model_ptr->source[n]->phi0     = inj->phi0;
+          model_ptr->source[n]->psi      = inj->psi;
+          model_ptr->source[n]->d2fdt2   = inj->d2fdt2;
+          map_params_to_array(model_ptr->source[n], model_ptr->source[n]->params, data_ptr->T);
+          
+        }
+        else if(flags->update)
+        {
+          draw_from_cdf(data_ptr, model_ptr, model_ptr->source[n], proposal[i][PROPOSAL_CDF], model_ptr->source[n]->params , chain->r[ic]);
+        }
+        else
+        {
+          draw_from_prior(data_ptr, model_ptr, model_ptr->source[n], proposal[i][0], model_ptr->source[n]->params , chain->r[ic]);
+        }
+        map_array_to_params(model_ptr->source[n], model_ptr->source[n]->params, data_ptr->T);
+        galactic_binary_fisher(orbit, data_ptr, model_ptr->source[n], data_ptr->noise[0]);
+      }
+      
+      // Form master model & compute likelihood of starting position
+      generate_noise_model(data_ptr, model_ptr);
+      generate_signal_model(orbit, data_ptr, model_ptr, -1);
+
+      //calibration error
+      if(flags->calibration)
+      {
+        draw_calibration_parameters(data_ptr, model_ptr, chain->r[ic]);
+        generate_calibration_model(data_ptr, model_ptr);
+        apply_calibration_model(data_ptr, model_ptr);
+      }
+      if(!flags->prior)
+      {
+        model_ptr->logL     = gaussian_log_likelihood(orbit, data_ptr, model_ptr);
+        model_ptr->logLnorm = gaussian_log_likelihood_constant_norm(data_ptr, model_ptr);
+      }
+      else model_ptr->logL = model_ptr->logLnorm = 0.0;
+      
+      if(ic==0) chain->logLmax += model_ptr->logL + model_ptr->logLnorm;
+      
+    }//end loop over frequency segments
+  }//end loop over chains
+  
+  /* Pick up where a preempted run left off */
+  int mcmc_start = -flags->NBURN;
+  int cycle = 0; //iterations done so far, keeps counting if burn-in restarts
+  
+  /* Effective sample size of the cold chain (logL, dimension, and parameters) */
+  struct Convergence *conv = malloc(sizeof(struct Convergence));
+  alloc_convergence(conv, 2+data[0]->NP, 2048);
+  double *sample = malloc(conv->K*sizeof(double));
+  
+  char checkpointFile[128];
+  sprintf(checkpointFile,"checkpoint/checkpoint.dat.%i",rank);
+  if(flags->resume) load_checkpoint(checkpointFile, orbit, data, model, chain, flags, proposal, conv, &mcmc_start, &cycle);
+  
+  int mcmc_stop = flags->NMCMC; //moved up if the cold chain converges early or time runs out
+  
+  //throughput of this run, for --walltime
+  double loop_start = wall_time();
+  int cycle_start = cycle;
+  
+#ifdef USE_MPI
+  //all ranks have truncated the chain files, now share them
+  mpi_append_chain_files(chain, flags);
+  MPI_Barrier(MPI_COMM_WORLD);
+  
+  fflush(stdout);
+  dup2(stdout_fd, STDOUT_FILENO);
+  close(stdout_fd);
+#endif
+  
+  /* The MCMC loop */
+  for(int mcmc = mcmc_start; mcmc < flags->NMCMC; mcmc++)
+  {
+    //chain updates, swaps, ladder/weight adaptation and max logL tracking
+    mcmc = mcmc_iteration(orbit, data, model, trial, chain, flags, prior, proposal, mcmc, cycle, rank, size);
+    
+    //output is written by the rank holding the cold chain
+    int cold = (chain->index[0]%size == rank);
+    
+    //track convergence of the cold chain after burn-in
+    int converged = 0;
+    if(mcmc>=0)
+    {
+      if(cold) convergence_sample(model[chain->index[0]], flags->NDATA, data[0]->NP, sample);
+#ifdef USE_MPI
+      //every rank keeps the same monitor so they agree on when to stop
+      MPI_Bcast(sample, conv->K, MPI_DOUBLE, chain->index[0]%size, MPI_COMM_WORLD);
+#endif
+      update_convergence(conv, sample);
+      
+      if(mcmc%data[FIXME]->downsample==0)
+      {
+        converged = check_convergence(conv, (double)flags->targetESS);
+        if(rank==0) print_convergence(conv, "convergence.dat", mcmc, (double)flags->targetESS);
+      }
+    }
+    else reset_convergence(conv);
+    
+    //replica round trips and swap rejection rates
+    if(rank==0 && mcmc%data[FIXME]->downsample==0) print_ladder(chain, flags, "ladder.dat", mcmc);
+    
+    //store reconstructed waveform
+    if(cold) print_waveform_draw(data, model[chain->index[0]], flags);
+    
+    //update run status
+    if(cold && mcmc%data[FIXME]->downsample==0)
+    {
+      for(int i=0; i<flags->NDATA; i++)
+      {
+        print_chain_state(data[i], chain, model[chain->index[0]][i], flags, stdout, mcmc);
+        fprintf(stdout,"Sources: %i\n",model[chain->index[0]][i]->Nlive);
+        print_acceptance_rates(proposal[i], chain->NP, 0, stdout);
+      }
+    }
+    
+    //dump waveforms to file, update avgLogL for thermodynamic integration
+    if(mcmc>0 && mcmc%data[FIXME]->downsample==0)
+    {
+      if(cold) for(int i=0; i<flags->NDATA; i++)save_waveforms(data[i], model[chain->index[0]][i], mcmc/data[i]->downsample);
+      for(ic=0; ic<NC; ic++)
+      {
+        chain->dimension[ic][model[chain->index[ic]][0]->Nlive]++;
+        for(int i=0; i<flags->NDATA; i++)
+          chain->avgLogL[ic] += model[chain->index[ic]][i]->logL + model[chain->index[ic]][i]->logLnorm;
+      }
+    }
+    
+#ifdef USE_MPI
+    //hand the shared chain files over to the next cold chain holder
+    fflush(NULL);
+#endif
+    
+    cycle++;
+    
+    //--walltime: fit the run into the time that is left
+    int outoftime = 0;
+    if(flags->walltime)
+    {
+      double now  = wall_time();
+      double rate = (now - loop_start)/(double)(cycle - cycle_start);
+      double used = now - run_start;
+      double left = (1.0 - WALLTIME_RESERVE)*(double)flags->walltime - used;
+#ifdef USE_MPI
+      //root rank's clock decides for everyone
+      MPI_Bcast(&rate, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      MPI_Bcast(&used, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+      MPI_Bcast(&left, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#endif
+      
+      //burn-in gets at most half of the budget
+      if(mcmc<0 && used > 0.5*(double)flags->walltime) mcmc = -1;
+      
+      //sampling starts next iteration, size it by the measured time per step
+      if(mcmc==-1)
+      {
+        fit_run_to_walltime(data, flags, (int)(left/rate));
+        mcmc_stop = flags->NMCMC;
+        if(rank==0) fprintf(stdout,"Wall time left for %i steps (downsample %i)\n",flags->NMCMC,data[0]->downsample);
+      }
+      
+      //another step would not fit
+      else if(mcmc>=0 && left < rate) outoftime = 1;
+    }
+    
+    //save state for --resume (the next iteration is mcmc+1)
+    if(flags->checkpoint && (cycle%flags->checkpoint==0 || outoftime))
+    {
+#ifdef USE_MPI
+      //chain files must not grow while their lengths are recorded
+      MPI_Barrier(MPI_COMM_WORLD);
+      save_checkpoint(checkpointFile, data, model, chain, flags, proposal, conv, mcmc+1, cycle);
+      MPI_Barrier(MPI_COMM_WORLD);
+#else
+      save_checkpoint(checkpointFile, data, model, chain, flags, proposal, conv, mcmc+1, cycle);
+#endif
+    }
+    
+    //--target-ess reached
+    if(converged)
+    {
+      if(rank==0) fprintf(stdout,"Cold chain reached %i effective samples at step %i\n",flags->targetESS,mcmc);
+      mcmc_stop = mcmc+1;
+      break;
+    }
+    
+    //--walltime reached
+    if(outoftime)
+    {
+      if(rank==0) fprintf(stdout,"Stopping at step %i to finish within %i seconds\n",mcmc,flags->walltime);
+      mcmc_stop = mcmc+1;
+      break;
+    }
+    
+  }// end MCMC loop
+  
+  //stopped early (or a short run), only the first waveform samples were saved
+  for(int i=0; i<flags->NDATA; i++)
+  {
+    int Nsaved = (mcmc_stop-1)/data[i]->downsample + 1;
+    if(Nsaved < data[i]->Nwave) data[i]->Nwave = Nsaved;
+  }
+  
+#ifdef USE_MPI
+  //collect waveform samples saved by each cold chain holder
+  for(int i=0; i<flags->NDATA; i++) mpi_combine_waveforms(data[i]);
+#endif
+  
+  //print aggregate run files/results
+  if(rank==0)
+  {
+    for(int i=0; i<flags->NDATA; i++)print_waveforms_reconstruction(data[i],i);
+    
+    FILE *chainFile = fopen("avg_log_likelihood.dat","w");
+    for(ic=0; ic<NC; ic++) fprintf(chainFile,"%lg %lg\n",1./chain->temperature[ic],chain->avgLogL[ic]/(double)(mcmc_stop/data[FIXME]->downsample));
+    fclose(chainFile);
+    
+    FILE *zFile = fopen("evidence.dat","w");
+    for(int i=0; i<DMAX; i++) fprintf(zFile,"%i %i\n",i,chain->dimension[0][i]);
+    fclose(zFile);
+  }
+  
+  //print total run time
+  stop = time(NULL);
+  
+  if(flags->verbose && rank==0) printf(" ELAPSED TIME = %g second\n",(double)(stop-start));
+  
+  
+  //free memory and exit cleanly
+  for(ic=0; ic<NC; ic++)
+  {
+    for(int i=0; i<flags->NDATA; i++)
+    {
+      free_history(model[ic][i]);
+      free_model(model[ic][i]);
+      free_model(trial[ic][i]);
+    }
+  }
+  if(flags->orbit)free_orbit(orbit);
+  //free_noise(data[0]->noise[FIXME]);
+  //free_tdi(data[0]->tdi[FIXME]);
+  free_chain(chain,flags);
+  free_convergence(conv);
+  free(conv);
+  free(sample);
+  //free(model[FIXME][FIXME]);
+  //free(trial[FIXME][FIXME]);
+  //free(data[0]);
+  
+#ifdef USE_MPI
+  MPI_Finalize();
+#endif
+  
+  return 0;
+}
+
+#ifdef USE_MPI
+void mpi_set_append(FILE *fptr)
+{
+  int fd = fileno(fptr);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_APPEND);
+}
+
+void mpi_append_chain_files(struct Chain *chain, struct Flags *flags)
+{
+  /*
+   Every rank opens the chain files, but only the rank holding a chain
+   writes to it.  Appending (and flushing after each iteration) keeps the
+   files ordered as the cold chain moves between ranks.
+   */
+  mpi_set_append(chain->likelihoodFile);
+  mpi_set_append(chain->temperatureFile);
+  mpi_set_append(chain->chainFile[0]);
+  mpi_set_append(chain->parameterFile[0]);
+  mpi_set_append(chain->noiseFile[0]);
+  for(int i=0; i<flags->DMAX; i++) mpi_set_append(chain->dimensionFile[i]);
+  if(flags->calibration) mpi_set_append(chain->calibrationFile[0]);
+  
+  if(flags->verbose)
+  {
+    for(int ic=1; ic<chain->NC; ic++)
+    {
+      mpi_set_append(chain->parameterFile[ic]);
+      mpi_set_append(chain->chainFile[ic]);
+      mpi_set_append(chain->noiseFile[ic]);
+    }
+  }
+}
+
+void mpi_reduce_waveform_samples(double *samples, int Nwave)
+{
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  
+  if(rank==0) MPI_Reduce(MPI_IN_PLACE, samples, Nwave, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  else        MPI_Reduce(samples, NULL, Nwave, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+}
+
+void mpi_combine_waveforms(struct Data *data)
+{
+  //each sample was saved by one rank, the others hold zeros
+  for(int k=0; k<data->NT; k++)
+  {
+    for(int l=0; l<data->Nchannel; l++)
+    {
+      for(int n=0; n<data->N; n++)
+      {
+        mpi_reduce_waveform_samples(data->h_rec[2*n][l][k],   data->Nwave);
+        mpi_reduce_waveform_samples(data->h_rec[2*n+1][l][k], data->Nwave);
+        mpi_reduce_waveform_samples(data->h_res[2*n][l][k],   data->Nwave);
+        mpi_reduce_waveform_samples(data->h_res[2*n+1][l][k], data->Nwave);
+        mpi_reduce_waveform_samples(data->r_pow[n][l][k],     data->Nwave);
+        mpi_reduce_waveform_samples(data->h_pow[n][l][k],     data->Nwave);
+        mpi_reduce_waveform_samples(data->S_pow[n][l][k],     data->Nwave);
+      }
+    }
+  }
+}
+#endif